@@ -0,0 +1,199 @@
+#include "Harmony.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Headless benchmark for the per-sample harmony path: CV in, harmonizer, voicer, CV out, the same as
+// NestlingAudio_Jazz does for one channel with nothing patched into its gate input.
+//
+// usage: benchexe [chords.json] [samples]
+
+
+// count every heap allocation so we notice if the hot path ever starts allocating
+static size_t allocationCount = 0;
+
+void* operator new(size_t size) {
+  allocationCount++;
+  void* p = std::malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+
+// synthetic CV for one test case, generated up front so only the harmony path is timed
+struct Stream {
+  std::string name;
+  std::vector<float> melody;
+  std::vector<float> root;
+  std::vector<float> chord;
+};
+
+static float noteToCV(int midi) {
+  return HarmonyCV::midiToCV(midi);
+}
+
+static float chordToCV(size_t chordTypeIndex, size_t numChords) {
+  // middle of the chord's slice of the 0-10v range
+  return (chordTypeIndex + 0.5f) * 10.f / numChords;
+}
+
+static std::vector<Stream> makeStreams(size_t samples, size_t numChords) {
+  std::vector<Stream> streams;
+  HarmonyRandom random;
+  random.seed(1);
+
+  // a new melody note ten times a second at 48kHz, a new chord every four notes
+  Stream stepped;
+  stepped.name = "stepped";
+  int note = 72, root = 0;
+  size_t chord = 0;
+  for (size_t i = 0; i < samples; i++) {
+    if (i % 4800 == 0) {
+      note = random.uniformInt(60, 84);
+      if (i % (4 * 4800) == 0) {
+        root = random.uniformInt(0, 11);
+        chord = random.uniformInt(0, numChords - 1);
+      }
+    }
+    stepped.melody.push_back(noteToCV(note));
+    stepped.root.push_back(noteToCV(root + 48));
+    stepped.chord.push_back(chordToCV(chord, numChords));
+  }
+  streams.push_back(stepped);
+
+  // worst case: a different note every sample and a different chord every 64
+  Stream randomNotes;
+  randomNotes.name = "random";
+  for (size_t i = 0; i < samples; i++) {
+    if (i % 64 == 0) {
+      root = random.uniformInt(0, 11);
+      chord = random.uniformInt(0, numChords - 1);
+    }
+    randomNotes.melody.push_back(noteToCV(random.uniformInt(36, 96)));
+    randomNotes.root.push_back(noteToCV(root + 48));
+    randomNotes.chord.push_back(chordToCV(chord, numChords));
+  }
+  streams.push_back(randomNotes);
+
+  // fast major scale runs up and down two octaves over a ii-V-I
+  Stream scale;
+  scale.name = "scale runs";
+  const int major[7] = {0, 2, 4, 5, 7, 9, 11};
+  const int progressionRoots[3] = {2, 7, 0};
+  const size_t progressionChords[3] = {2, 4, 5};
+  for (size_t i = 0; i < samples; i++) {
+    size_t step = i / 120;
+    size_t position = step % 28;
+    size_t degree = position < 14 ? position : 28 - position;
+    size_t bar = (step / 28) % 3;
+    scale.melody.push_back(noteToCV(60 + 12 * (degree / 7) + major[degree % 7]));
+    scale.root.push_back(noteToCV(progressionRoots[bar] + 48));
+    scale.chord.push_back(chordToCV(progressionChords[bar] % numChords, numChords));
+  }
+  streams.push_back(scale);
+
+  // audio-rate vibrato wide enough to cross several semitones, with a little noise on top
+  Stream modulation;
+  modulation.name = "fast modulation";
+  for (size_t i = 0; i < samples; i++) {
+    float lfo = std::sin(2.f * M_PI * 220.f * i / 48000.f);
+    float noise = (random.next() / 4294967296.f - 0.5f) * 0.01f;
+    modulation.melody.push_back(1.f + 0.25f * lfo + noise);
+    modulation.root.push_back(noteToCV(48));
+    modulation.chord.push_back(chordToCV((i / 2400) % numChords, numChords));
+  }
+  streams.push_back(modulation);
+
+  return streams;
+}
+
+
+struct Result {
+  double nsPerSample;
+  size_t allocations;
+  float checksum;
+};
+
+static Result run(Harmonizer* harmonizer, Voicer* voicer, const Stream &stream, size_t numChords) {
+  HarmonyState state;
+  float checksum = 0.f;
+  size_t samples = stream.melody.size();
+
+  size_t allocationsBefore = allocationCount;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < samples; i++) {
+    int melNote = HarmonyCV::cvToMidi(stream.melody[i]);
+    int rootBase = HarmonyCV::cvToMidi(stream.root[i]) % 12;
+    size_t chordTypeIndex = HarmonyCV::cvToIndex(stream.chord[i], numChords);
+
+    int offsets[MAX_VOICES];
+    harmonizer->computeOffsets(chordTypeIndex, melNote, rootBase, DEFAULT_VOICES, state, offsets);
+    voicer->adjustOffsets(offsets, DEFAULT_VOICES);
+
+    checksum += HarmonyCV::midiToCV(melNote + offsets[0]);
+    checksum += HarmonyCV::midiToCV(melNote + offsets[1]);
+    checksum += HarmonyCV::midiToCV(melNote + offsets[2]);
+  }
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+  Result result;
+  result.nsPerSample = std::chrono::duration<double, std::nano>(end - start).count() / samples;
+  result.allocations = allocationCount - allocationsBefore;
+  result.checksum = checksum;
+  return result;
+}
+
+
+int main(int argc, char** argv) {
+  std::string chordsPath = argc > 1 ? argv[1] : "res/chords.json";
+  size_t samples = argc > 2 ? std::strtoul(argv[2], NULL, 10) : 48000 * 10;
+
+  std::ifstream file(chordsPath.c_str());
+  if (!file) {
+    std::fprintf(stderr, "can't open %s\n", chordsPath.c_str());
+    return 1;
+  }
+  std::stringstream text;
+  text << file.rdbuf();
+  ChordTable chords;
+  int line, column;
+  std::string error;
+  if (!chords.parseJson(text.str(), &line, &column, &error)) {
+    std::fprintf(stderr, "%s:%d:%d: %s\n", chordsPath.c_str(), line, column, error.c_str());
+    return 1;
+  }
+
+  HarmonyStrategies strategies;
+  strategies.init(&chords);
+  strategies.randomPassing.random.seed(1);
+
+  std::vector<Stream> streams = makeStreams(samples, chords.size());
+
+  std::printf("%zu samples per run, %zu chord types\n\n", samples, chords.size());
+  std::printf("%-20s %-10s %-16s %10s %14s %8s\n", "harmonizer", "voicing", "stream", "ns/sample", "samples/sec", "allocs");
+  float checksum = 0.f;
+  for (Harmonizer* harmonizer : strategies.harmonizers) {
+    for (Voicer* voicer : strategies.voicers) {
+      for (const Stream &stream : streams) {
+        Result result = run(harmonizer, voicer, stream, chords.size());
+        checksum += result.checksum;
+        std::printf("%-20s %-10s %-16s %10.2f %14.0f %8zu\n",
+            harmonizer->displayName().c_str(), voicer->displayName().c_str(), stream.name.c_str(),
+            result.nsPerSample, 1e9 / result.nsPerSample, result.allocations);
+      }
+    }
+  }
+  // printed so the compiler can't throw the work away
+  std::printf("\nchecksum %f\n", checksum);
+  return 0;
+}
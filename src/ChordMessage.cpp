@@ -0,0 +1,22 @@
+#include "ChordMessage.hpp"
+
+
+bool isChordExpander(Module* module) {
+  return module && (module->model == modelNestlingAudio_ChordOut || module->model == modelNestlingAudio_MidiOut);
+}
+
+const ChordMessage* receiveChordMessage(Module* expander) {
+  Module* source = expander->leftExpander.module;
+  if (!source || (source->model != modelNestlingAudio_Jazz && !isChordExpander(source)))
+    return NULL;
+  return (const ChordMessage*) expander->leftExpander.consumerMessage;
+}
+
+// the next expander gets the same message a sample later; Jazz never sees how long the chain is
+void forwardChordMessage(Module* expander, const ChordMessage &message) {
+  Module* next = expander->rightExpander.module;
+  if (!isChordExpander(next))
+    return;
+  *(ChordMessage*) next->leftExpander.producerMessage = message;
+  next->leftExpander.requestMessageFlip();
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include "plugin.hpp"
+#include "Harmony.hpp"
+
+
+// chord tones carried per channel, the root included; chords with more are cut short
+static const int MAX_CHORD_TONES = 8;
+
+// What Jazz hands the expander on its right each time it harmonizes, through Rack's double-buffered expander
+// messages.  Plain fixed-size data so a whole message is copied with no allocation, and each expander passes it
+// on to the next one, so Jazz only ever writes one no matter how many are chained.
+struct ChordMessage {
+  uint32_t sequence;  // counts messages, so a reader can tell a new one from the one it already handled
+  int32_t channels;  // melody channels
+  int32_t numVoices;
+  uint32_t changed;  // bit per channel: the root or chord type differs from the previous message
+  int8_t root[PORT_MAX_CHANNELS];  // pitch class
+  int16_t chordTypeIndex[PORT_MAX_CHANNELS];
+  int8_t numChordTones[PORT_MAX_CHANNELS];
+  int8_t chordTones[PORT_MAX_CHANNELS][MAX_CHORD_TONES];  // semitones above the root, starting with the root's 0
+  int16_t melody[PORT_MAX_CHANNELS];  // midi note
+  int8_t offsets[PORT_MAX_CHANNELS][MAX_VOICES];  // each harmony voice's semitones from the melody
+};
+
+// true for the modules that take ChordMessages on their left and pass them on to their right
+bool isChordExpander(Module* module);
+
+// an expander's side of the chain: the latest message from the module on its left, or NULL when that module
+// doesn't send them; and passing a message on to the expander on its right, if there is one
+const ChordMessage* receiveChordMessage(Module* expander);
+void forwardChordMessage(Module* expander, const ChordMessage &message);
@@ -0,0 +1,736 @@
+#include "Harmony.hpp"
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+
+void HarmonyRandom::seed(uint64_t seed) {
+  // expand the seed with splitmix64 so that nearby seeds give unrelated sequences
+  for (int i = 0; i < 4; i++) {
+    uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    s[i] = (uint32_t) ((z ^ (z >> 31)) >> 32);
+  }
+}
+
+uint32_t HarmonyRandom::next() {
+  uint32_t result = s[1] * 5;
+  result = ((result << 7) | (result >> 25)) * 9;
+  uint32_t t = s[1] << 9;
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = (s[3] << 11) | (s[3] >> 21);
+  return result;
+}
+
+int HarmonyRandom::uniformInt(int lo, int hi) {
+  uint32_t range = hi - lo + 1;
+  return lo + (int) (((uint64_t) next() * range) >> 32);
+}
+
+void ChordTable::addChord(const std::string &name, const std::vector<int> &chordInts, const std::vector<int> &scaleInts) {
+  if (offsets.empty()) offsets.push_back(0);
+  names.push_back(name);
+  intervals.insert(intervals.end(), chordInts.begin(), chordInts.end());
+  offsets.push_back(intervals.size());
+
+  int scaleMask = 1;
+  for (int interval : chordInts) scaleMask |= 1 << ((interval % 12 + 12) % 12);
+  for (int interval : scaleInts) scaleMask |= 1 << ((interval % 12 + 12) % 12);
+  scaleMasks.push_back(scaleMask);
+}
+
+void ChordTable::buildHarmonyTable() {
+  // the harmony only depends on the chord type and the melody's pitch class relative to the root,
+  // so work out every combination once here instead of on every call to computeOffsets
+  harmonyTable.resize(size() * 12);
+  for (size_t c = 0; c < size(); c++) {
+    std::vector<int> chordTones;
+    chordTones.push_back(0);
+    chordTones.insert(chordTones.end(), chordIntervals(c), chordIntervals(c) + numIntervals(c));
+    const int numTones = chordTones.size();
+
+    for (int relativeMelNote = 0; relativeMelNote < 12; relativeMelNote++) {
+      HarmonyEntry &entry = harmonyTable[c * 12 + relativeMelNote];
+      // find index of relativeMelNote in chordTones
+      int idx = -1;
+      for (int m = 0; m < numTones; m++) {
+        if (chordTones[m] % 12 == relativeMelNote) {
+          idx = m;
+          break;
+        }
+      }
+      entry.chordTone = (idx != -1);
+      for (int v = 0; v < MAX_VOICES; v++) {
+        if (idx == -1) {
+          entry.offsets[v] = 0;
+          continue;
+        }
+        // harmony tones walk down through the chord from the melody note; once every chord tone
+        // has been used (more voices than chord notes) carry on an octave lower
+        int j = ((idx - 1 - v) % numTones + numTones) % numTones;
+        int distance = ((relativeMelNote - chordTones[j]) % 12 + 12) % 12;
+        if (distance == 0) distance = 12;
+        entry.offsets[v] = -distance - 12 * (v / numTones);
+      }
+    }
+  }
+}
+
+void ChordTable::buildScaleTable() {
+  scaleTable.resize(size() * 12);
+  for (size_t c = 0; c < size(); c++) {
+    int scale[12];
+    int scaleSize = 0;
+    for (int pitchClass = 0; pitchClass < 12; pitchClass++) {
+      if (scaleMasks[c] & (1 << pitchClass)) scale[scaleSize++] = pitchClass;
+    }
+
+    for (int relativeMelNote = 0; relativeMelNote < 12; relativeMelNote++) {
+      HarmonyEntry &entry = scaleTable[c * 12 + relativeMelNote];
+      int degree = std::find(scale, scale + scaleSize, relativeMelNote) - scale;
+      entry.chordTone = (degree < scaleSize);
+      for (int v = 0; v < MAX_VOICES; v++) {
+        if (!entry.chordTone) {
+          entry.offsets[v] = 0;
+          continue;
+        }
+        // a third down the scale is two scale steps, wrapping into the octave below
+        int step = degree - 2 * (v + 1);
+        int octave = (step >= 0) ? 0 : (step - scaleSize + 1) / scaleSize;
+        int note = scale[step - octave * scaleSize] + 12 * octave;
+        entry.offsets[v] = note - relativeMelNote;
+      }
+    }
+  }
+}
+
+// every way of giving numVoices voices chord tones from the pool, highest first, that uses at least
+// wantedPitchClasses different pitch classes counting the melody; stops once the list is full
+static void addVoicings(std::vector<Voicing>* out, size_t listStart, const int* pool, int poolSize,
+    int numVoices, int wantedPitchClasses, int first, int depth, Voicing &voicing) {
+  if (out->size() - listStart >= MAX_VOICINGS) return;
+  if (depth == numVoices) {
+    bool used[12] = {true};  // the melody's own pitch class
+    int numUsed = 1;
+    for (int v = 0; v < numVoices; v++) {
+      int pitchClass = (voicing.offsets[v] % 12 + 12) % 12;
+      if (!used[pitchClass]) numUsed++;
+      used[pitchClass] = true;
+    }
+    if (numUsed >= wantedPitchClasses) out->push_back(voicing);
+    return;
+  }
+  for (int i = first; i <= poolSize - (numVoices - depth); i++) {
+    voicing.offsets[depth] = pool[i];
+    addVoicings(out, listStart, pool, poolSize, numVoices, wantedPitchClasses, i + 1, depth + 1, voicing);
+  }
+}
+
+void ChordTable::buildVoicingTable() {
+  // candidates come from the chord tones in the two octaves below the melody, closest voicings first, so
+  // the voice-leading harmonizer only ever scans a short list instead of searching
+  voicings.clear();
+  voicingOffsets.assign(1, 0);
+  for (size_t c = 0; c < size(); c++) {
+    bool inChord[12] = {true};  // the root
+    for (size_t k = 0; k < numIntervals(c); k++) {
+      inChord[(chordIntervals(c)[k] % 12 + 12) % 12] = true;
+    }
+    int numPitchClasses = std::count(inChord, inChord + 12, true);
+
+    for (int numVoices = MIN_VOICES; numVoices <= MAX_VOICES; numVoices++) {
+      for (int relativeMelNote = 0; relativeMelNote < 12; relativeMelNote++) {
+        if (inChord[relativeMelNote]) {
+          int pool[24];
+          int poolSize = 0;
+          for (int offset = -1; offset >= -24; offset--) {
+            if (inChord[((relativeMelNote + offset) % 12 + 12) % 12]) pool[poolSize++] = offset;
+          }
+          // double chord tones only when there are more voices than chord tones
+          int wantedPitchClasses = std::min(numVoices + 1, numPitchClasses);
+          Voicing voicing = {};
+          addVoicings(&voicings, voicings.size(), pool, poolSize, numVoices, wantedPitchClasses, 0, 0, voicing);
+        }
+        voicingOffsets.push_back(voicings.size());
+      }
+    }
+  }
+}
+
+void ChordTable::buildRecognitionTable() {
+  // every chord type on every root, as pitch class masks
+  std::vector<int> chordMasks;
+  for (size_t c = 0; c < size(); c++) {
+    int mask = 1;
+    for (size_t k = 0; k < numIntervals(c); k++) {
+      mask |= 1 << ((chordIntervals(c)[k] % 12 + 12) % 12);
+    }
+    for (int root = 0; root < 12; root++) {
+      chordMasks.push_back(((mask << root) | (mask >> (12 - root))) & 0xfff);
+    }
+  }
+  int numNotes[4096];
+  for (int mask = 0; mask < 4096; mask++) {
+    numNotes[mask] = (mask & 1) + (mask ? numNotes[mask >> 1] : 0);
+  }
+
+  // each mask gets the chord that shares the most notes with it, losing a point for each chord tone it
+  // leaves out and two for each of its notes the chord doesn't have; ties go to a chord whose root is
+  // among the notes, then to the earlier chord type in chords.json
+  recognitionTable.assign(4096, ChordMatch {-1, -1});
+  for (int mask = 1; mask < 4096; mask++) {
+    int bestScore = INT_MIN;
+    size_t best = 0;
+    for (size_t k = 0; k < chordMasks.size(); k++) {
+      int chordMask = chordMasks[k];
+      int common = numNotes[mask & chordMask];
+      int missing = numNotes[chordMask & ~mask];
+      int extra = numNotes[mask & ~chordMask];
+      int score = 4 * (2 * common - missing - 2 * extra) + ((mask >> (k % 12)) & 1);
+      if (score > bestScore) {
+        bestScore = score;
+        best = k;
+      }
+    }
+    // two notes are too few to name a chord unless they are all of it
+    if (numNotes[mask] >= 3 || chordMasks[best] == mask) {
+      recognitionTable[mask].root = (int16_t) (best % 12);
+      recognitionTable[mask].chordTypeIndex = (int16_t) (best / 12);
+    }
+  }
+}
+
+// Just enough JSON to read chords.json: an array of objects, of which we keep "name", "intervals" and "scale"
+// and skip anything else.  The plugin, tests and tools all read chords.json through this, so the core needn't
+// link Rack's jansson.
+struct ChordJsonReader {
+  const char* p;
+  const char* lineStart;
+  int line = 1;
+  std::string error;
+
+  ChordJsonReader(const std::string &text) : p(text.c_str()), lineStart(text.c_str()) {}
+
+  bool fail(const char* message) {
+    if (error.empty()) error = message;
+    return false;
+  }
+  void skipSpace() {
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+      if (*p == '\n') {
+        line++;
+        lineStart = p + 1;
+      }
+      p++;
+    }
+  }
+  bool expect(char c) {
+    skipSpace();
+    if (*p != c) return fail(c == ']' || c == '}' ? "unexpected token" : "'[', '{', ':' or ',' expected");
+    p++;
+    return true;
+  }
+  bool peek(char c) {
+    skipSpace();
+    return *p == c;
+  }
+
+  bool readString(std::string* out) {
+    if (!expect('"')) return false;
+    for (;;) {
+      char c = *p++;
+      if (c == '\0') return fail("premature end of input");
+      if (c == '"') return true;
+      if (c == '\\') {
+        c = *p++;
+        switch (c) {
+          case 'n': c = '\n'; break;
+          case 't': c = '\t'; break;
+          case 'r': c = '\r'; break;
+          case 'b': c = '\b'; break;
+          case 'f': c = '\f'; break;
+          case 'u':
+            // chord names are plain ascii; keep a placeholder for anything else
+            for (int i = 0; i < 4; i++) {
+              if (*p == '\0') return fail("premature end of input");
+              p++;
+            }
+            c = '?';
+            break;
+          case '\0': return fail("premature end of input");
+          default: break;  // '"', '\\' and '/' stand for themselves
+        }
+      }
+      if (out) out->push_back(c);
+    }
+  }
+
+  // JSON's number grammar, converted by hand rather than with strtod, which reads "1.5" differently under a
+  // locale with a decimal comma
+  bool readNumber(double* out) {
+    skipSpace();
+    const char* start = p;
+    double sign = 1.0;
+    if (*p == '-') {
+      sign = -1.0;
+      p++;
+    }
+    if (!std::isdigit((unsigned char) *p)) {
+      p = start;
+      return fail("invalid token");
+    }
+    double value = 0.0;
+    if (*p == '0') {
+      p++;
+    } else {
+      while (std::isdigit((unsigned char) *p)) value = value * 10.0 + (*p++ - '0');
+    }
+    if (*p == '.') {
+      p++;
+      if (!std::isdigit((unsigned char) *p)) return fail("invalid token");
+      double scale = 0.1;
+      while (std::isdigit((unsigned char) *p)) {
+        value += (*p++ - '0') * scale;
+        scale *= 0.1;
+      }
+    }
+    if (*p == 'e' || *p == 'E') {
+      p++;
+      bool negative = *p == '-';
+      if (*p == '-' || *p == '+') p++;
+      if (!std::isdigit((unsigned char) *p)) return fail("invalid token");
+      int exponent = 0;
+      while (std::isdigit((unsigned char) *p)) exponent = std::min(exponent * 10 + (*p++ - '0'), 400);
+      for (int i = 0; i < exponent; i++) value = negative ? value * 0.1 : value * 10.0;
+    }
+    if (out) *out = sign * value;
+    return true;
+  }
+
+  bool skipValue() {
+    skipSpace();
+    if (*p == '"') return readString(NULL);
+    if (*p == '[') {
+      p++;
+      if (peek(']')) return expect(']');
+      do {
+        if (!skipValue()) return false;
+      } while (peek(',') && expect(','));
+      return expect(']');
+    }
+    if (*p == '{') {
+      p++;
+      if (peek('}')) return expect('}');
+      do {
+        if (!readString(NULL) || !expect(':') || !skipValue()) return false;
+      } while (peek(',') && expect(','));
+      return expect('}');
+    }
+    const char* literals[] = {"true", "false", "null"};
+    for (const char* literal : literals) {
+      size_t len = std::strlen(literal);
+      if (std::strncmp(p, literal, len) == 0) {
+        p += len;
+        return true;
+      }
+    }
+    return readNumber(NULL);
+  }
+
+  bool readIntervals(std::vector<int>* out) {
+    if (!expect('[')) return false;
+    if (peek(']')) return expect(']');
+    do {
+      double value;
+      if (!readNumber(&value)) return false;
+      out->push_back((int) value);
+    } while (peek(',') && expect(','));
+    return expect(']');
+  }
+
+  bool readChord(ChordTable* table) {
+    std::string name = "error";
+    std::vector<int> chordInts;
+    std::vector<int> scaleInts;
+    if (!expect('{')) return false;
+    if (!peek('}')) {
+      do {
+        std::string key;
+        if (!readString(&key) || !expect(':')) return false;
+        bool ok;
+        if (key == "name") {
+          name.clear();
+          ok = readString(&name);
+        } else if (key == "intervals") {
+          ok = readIntervals(&chordInts);
+        } else if (key == "scale") {
+          ok = readIntervals(&scaleInts);
+        } else {
+          ok = skipValue();
+        }
+        if (!ok) return false;
+      } while (peek(',') && expect(','));
+    }
+    if (!expect('}')) return false;
+    table->addChord(name, chordInts, scaleInts);
+    return true;
+  }
+
+  bool readTable(ChordTable* table) {
+    if (!expect('[')) return false;
+    if (!peek(']')) {
+      do {
+        if (!readChord(table)) return false;
+      } while (peek(',') && expect(','));
+    }
+    if (!expect(']')) return false;
+    skipSpace();
+    if (*p != '\0') return fail("end of file expected");
+    return true;
+  }
+};
+
+bool ChordTable::parseJson(const std::string &text, int* errorLine, int* errorColumn, std::string* errorText) {
+  ChordJsonReader reader(text);
+  if (!reader.readTable(this)) {
+    if (errorLine) *errorLine = reader.line;
+    if (errorColumn) *errorColumn = reader.p - reader.lineStart + 1;
+    if (errorText) *errorText = reader.error;
+    return false;
+  }
+  buildTables();
+  return true;
+}
+
+void ChordTable::buildTables() {
+  buildHarmonyTable();
+  buildScaleTable();
+  buildVoicingTable();
+  buildRecognitionTable();
+}
+
+
+// chords.bin layout, every field a little-endian uint32 unless noted:
+//   magic "NACT", version, chord count, interval count, name bytes
+//   interval offsets [chords + 1], intervals (int32) [intervals], scale masks [chords],
+//   name offsets [chords + 1], names (utf-8, not terminated) padded to a multiple of 4
+// Only the chord definitions are stored; the lookup tables are rebuilt on load, which takes a few ms.
+static const char CHORDS_BIN_MAGIC[4] = {'N', 'A', 'C', 'T'};
+static const uint32_t CHORDS_BIN_VERSION = 1;
+static const size_t CHORDS_BIN_HEADER = 20;
+
+static uint32_t readU32(const uint8_t* p) {
+  return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static void appendU32(std::string* out, uint32_t value) {
+  out->push_back((char) (value & 0xff));
+  out->push_back((char) ((value >> 8) & 0xff));
+  out->push_back((char) ((value >> 16) & 0xff));
+  out->push_back((char) ((value >> 24) & 0xff));
+}
+
+bool ChordTable::isBinary(const void* data, size_t size) {
+  return size >= sizeof(CHORDS_BIN_MAGIC) && std::memcmp(data, CHORDS_BIN_MAGIC, sizeof(CHORDS_BIN_MAGIC)) == 0;
+}
+
+bool ChordTable::parseBinary(const void* data, size_t size, std::string* errorText) {
+  const uint8_t* bytes = (const uint8_t*) data;
+  const char* error = NULL;
+  if (!isBinary(data, size) || size < CHORDS_BIN_HEADER) {
+    error = "not a chords.bin file";
+  } else if (readU32(bytes + 4) != CHORDS_BIN_VERSION) {
+    error = "unsupported chords.bin version";
+  }
+  uint32_t numChords = 0, totalIntervals = 0, nameBytes = 0;
+  if (!error) {
+    numChords = readU32(bytes + 8);
+    totalIntervals = readU32(bytes + 12);
+    nameBytes = readU32(bytes + 16);
+    // in 64 bits so a corrupt count can't wrap around and pass the size check
+    uint64_t expected = CHORDS_BIN_HEADER + 4 * ((uint64_t) numChords * 3 + 2 + totalIntervals) + ((uint64_t) nameBytes + 3) / 4 * 4;
+    if (numChords == 0 || expected != size) error = "chords.bin is truncated or corrupt";
+  }
+
+  const uint8_t* intervalOffsets = bytes + CHORDS_BIN_HEADER;
+  const uint8_t* intervalData = intervalOffsets + 4 * (numChords + 1);
+  const uint8_t* masks = intervalData + 4 * totalIntervals;
+  const uint8_t* nameOffsets = masks + 4 * numChords;
+  const char* nameData = (const char*) (nameOffsets + 4 * (numChords + 1));
+
+  for (uint32_t c = 0; c < numChords && !error; c++) {
+    uint32_t first = readU32(intervalOffsets + 4 * c), last = readU32(intervalOffsets + 4 * (c + 1));
+    uint32_t nameFirst = readU32(nameOffsets + 4 * c), nameLast = readU32(nameOffsets + 4 * (c + 1));
+    if (first > last || last > totalIntervals || nameFirst > nameLast || nameLast > nameBytes) {
+      error = "chords.bin is truncated or corrupt";
+      break;
+    }
+    std::vector<int> chordInts;
+    for (uint32_t i = first; i < last; i++) chordInts.push_back((int32_t) readU32(intervalData + 4 * i));
+    std::vector<int> scaleInts;
+    uint32_t mask = readU32(masks + 4 * c);
+    for (int pitchClass = 0; pitchClass < 12; pitchClass++) {
+      if (mask & (1 << pitchClass)) scaleInts.push_back(pitchClass);
+    }
+    addChord(std::string(nameData + nameFirst, nameLast - nameFirst), chordInts, scaleInts);
+  }
+
+  if (error) {
+    if (errorText) *errorText = error;
+    return false;
+  }
+  buildTables();
+  return true;
+}
+
+std::string ChordTable::toBinary() const {
+  std::string out(CHORDS_BIN_MAGIC, sizeof(CHORDS_BIN_MAGIC));
+  size_t nameBytes = 0;
+  for (const std::string &name : names) nameBytes += name.size();
+  appendU32(&out, CHORDS_BIN_VERSION);
+  appendU32(&out, size());
+  appendU32(&out, intervals.size());
+  appendU32(&out, nameBytes);
+  for (size_t c = 0; c <= size(); c++) appendU32(&out, offsets.empty() ? 0 : offsets[c]);
+  for (int interval : intervals) appendU32(&out, (uint32_t) interval);
+  for (int mask : scaleMasks) appendU32(&out, (uint32_t) mask);
+  size_t nameOffset = 0;
+  appendU32(&out, 0);
+  for (const std::string &name : names) {
+    nameOffset += name.size();
+    appendU32(&out, nameOffset);
+  }
+  for (const std::string &name : names) out += name;
+  out.resize((out.size() + 3) / 4 * 4, '\0');
+  return out;
+}
+
+void Harmonizer::init(const ChordTable* chords) {
+  this->chords = chords;
+}
+
+void BasicHarmonizer::_setPassingNoteOffsets(size_t chordTypeIndex, int melody, int root, int numVoices, HarmonyState& state, int* offsets) {
+    // note not in chord --> use fully diminished chord as harmony, stacking minor thirds down past the octave
+    for (int v = 0; v < numVoices; v++) {
+      offsets[v] = -3 * (v + 1);
+    }
+}
+
+void BasicHarmonizer::computeOffsets(size_t chordTypeIndex, int melody, int root, int numVoices, HarmonyState& state, int* offsets) {
+  int relativeMelNote = (melody - root) % 12;
+  if (relativeMelNote < 0) relativeMelNote += 12;
+  const HarmonyEntry &entry = chords->harmonyEntry(chordTypeIndex, relativeMelNote);
+  if (!entry.chordTone) {
+    _setPassingNoteOffsets(chordTypeIndex, melody, root, numVoices, state, offsets);
+  } else {
+    for (int v = 0; v < numVoices; v++) {
+      offsets[v] = entry.offsets[v];
+    }
+  }
+  state.remember(melody, offsets, numVoices);
+}
+std::string BasicHarmonizer::displayName() {
+  return "Diminished Passing";
+}
+
+void ParallelHarmonizer::_setPassingNoteOffsets(size_t chordTypeIndex, int melody, int root, int numVoices, HarmonyState& state, int* offsets) {
+  for (int v = 0; v < numVoices; v++) {
+    offsets[v] = state.lastOffsets[v];
+  }
+}
+
+std::string ParallelHarmonizer::displayName() {
+  return "Parallel Passing";
+}
+
+void RandomPassingHarmonizer::_setPassingNoteOffsets(size_t chordTypeIndex, int melody, int root, int numVoices, HarmonyState& state, int* offsets) {
+  if (melody == state.lastNote) {
+    for (int v = 0; v < numVoices; v++) {
+      offsets[v] = state.lastOffsets[v];
+    }
+    return;
+  }
+  int third = random.uniformInt(2, 5);  // M2 through P4
+  int fifth = random.uniformInt(third == 5 ? 7 : 6, 8);  // D5, P5 or A5
+  int seventh = random.uniformInt(fifth == 8 ? 10 : 9, 11);  // M6 thru M7
+
+  int possibleOffsets[4] = {0, third, fifth, seventh};
+
+  int melIndex = random.uniformInt(0, 3);
+  int delta = possibleOffsets[melIndex];
+  possibleOffsets[0] -= delta;
+  possibleOffsets[1] -= delta;
+  possibleOffsets[2] -= delta;
+  possibleOffsets[3] -= delta;
+  // TODO: there's some common-ish code between here and ChordTable::buildHarmonyTable, write unit tests and refactor
+  // walk down through the four chord tones from the melody, an octave lower each time round
+  int j = melIndex;
+  for (int v = 0; v < numVoices; v++) {
+    j = (j + 3) % 4;
+    offsets[v] = (possibleOffsets[j] % 12);
+    if (offsets[v] >= 0) offsets[v] -= 12;
+    offsets[v] -= 12 * (v / 4);
+  }
+}
+std::string RandomPassingHarmonizer::displayName() {
+  return "Random Passing";
+}
+
+// after a drop the dropped voices belong further down the list
+static void sortHighestFirst(int* offsets, int numVoices) {
+  for (int i = 1; i < numVoices; i++) {
+    int offset = offsets[i];
+    int j = i;
+    for (; j > 0 && offsets[j - 1] < offset; j--) {
+      offsets[j] = offsets[j - 1];
+    }
+    offsets[j] = offset;
+  }
+}
+
+void ScaleHarmonizer::_setPassingNoteOffsets(size_t chordTypeIndex, int melody, int root, int numVoices, HarmonyState& state, int* offsets) {
+  int relativeMelNote = (melody - root) % 12;
+  if (relativeMelNote < 0) relativeMelNote += 12;
+  const HarmonyEntry &entry = chords->scaleEntry(chordTypeIndex, relativeMelNote);
+  if (!entry.chordTone) {
+    BasicHarmonizer::_setPassingNoteOffsets(chordTypeIndex, melody, root, numVoices, state, offsets);
+    return;
+  }
+  for (int v = 0; v < numVoices; v++) {
+    offsets[v] = entry.offsets[v];
+  }
+}
+std::string ScaleHarmonizer::displayName() {
+  return "Scale Passing";
+}
+
+void VoiceLeadingHarmonizer::computeOffsets(size_t chordTypeIndex, int melody, int root, int numVoices, HarmonyState& state, int* offsets) {
+  int relativeMelNote = (melody - root) % 12;
+  if (relativeMelNote < 0) relativeMelNote += 12;
+  size_t count;
+  const Voicing* candidates = chords->candidateVoicings(chordTypeIndex, numVoices, relativeMelNote, &count);
+
+  // before the first harmony the remembered voices sit below note 0, and there is nothing to lead from
+  bool canLead = count > 0 && state.lastNote + state.lastOffsets[numVoices - 1] >= 0;
+  if (!canLead) {
+    BasicHarmonizer::computeOffsets(chordTypeIndex, melody, root, numVoices, state, offsets);
+  } else {
+    // total semitones moved, top voice to top voice; the first (closest) voicing wins a tie
+    size_t best = 0;
+    int bestCost = INT_MAX;
+    for (size_t k = 0; k < count; k++) {
+      int cost = 0;
+      for (int v = 0; v < numVoices; v++) {
+        cost += std::abs(melody + candidates[k].offsets[v] - (state.lastNote + state.lastOffsets[v]));
+      }
+      if (cost < bestCost) {
+        bestCost = cost;
+        best = k;
+      }
+    }
+    for (int v = 0; v < numVoices; v++) {
+      offsets[v] = candidates[best].offsets[v];
+    }
+  }
+
+  state.remember(melody, offsets, numVoices);
+}
+std::string VoiceLeadingHarmonizer::displayName() {
+  return "Voice Leading";
+}
+
+void CloseVoicer::adjustOffsets(int* offsets, int numVoices) {
+  // do nothing because the harmonizers already output close voicing
+}
+std::string CloseVoicer::displayName() {
+  return "Close";
+}
+
+// with more than four voices the dropped note can land on a voice that is already there, which then moves
+// down an octave in its turn
+static void dropOctave(int* offsets, int numVoices, int voice) {
+  offsets[voice] -= 12;
+  for (int v = 0; v < numVoices; v++) {
+    if (v != voice && offsets[v] == offsets[voice]) {
+      dropOctave(offsets, numVoices, v);
+      return;
+    }
+  }
+}
+
+void DropTwoVoicer::adjustOffsets(int* offsets, int numVoices) {
+  // voice two counting down from the melody is the first harmony voice
+  dropOctave(offsets, numVoices, 0);
+  sortHighestFirst(offsets, numVoices);
+}
+std::string DropTwoVoicer::displayName() {
+  return "Drop 2";
+}
+
+void DropTwoFourVoicer::adjustOffsets(int* offsets, int numVoices) {
+  dropOctave(offsets, numVoices, 0);
+  if (numVoices > 2) dropOctave(offsets, numVoices, 2);
+  sortHighestFirst(offsets, numVoices);
+}
+std::string DropTwoFourVoicer::displayName() {
+  return "Drop 2+4";
+}
+
+
+HarmonyStrategies::HarmonyStrategies() {
+  harmonizers[0] = &basic;
+  harmonizers[1] = &parallel;
+  harmonizers[2] = &randomPassing;
+  harmonizers[3] = &scale;
+  harmonizers[4] = &voiceLeading;
+  voicers[0] = &close;
+  voicers[1] = &dropTwo;
+  voicers[2] = &dropTwoFour;
+}
+
+void HarmonyStrategies::init(const ChordTable* chords) {
+  for (Harmonizer* harmonizer : harmonizers) {
+    harmonizer->init(chords);
+  }
+}
+
+
+int HarmonyCV::cvToMidi(const float voltage) {
+  return std::round(voltage * 12 + 60);
+}
+
+float HarmonyCV::midiToCV(const int midi) {
+  return (midi - 60) / 12.0f;
+}
+
+int HarmonyCV::voiceNote(const int melody, const int offset) {
+  int note = melody + offset;
+  return note < 0 ? melody : note;
+}
+
+std::string HarmonyCV::midiToString(const int midi) {
+  std::string notes[] = {"C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B"};
+  return notes[midi % 12];
+}
+
+size_t HarmonyCV::cvToIndex(const float voltage, const size_t length) {
+  float index = 0.f;
+  // TODO: consider making this a switch in the UI instead of a hardcoded constant
+  if (VOLTAGE_UNIPOLAR) {
+    index = voltage / 10.0f * length;
+  } else {
+    index = (voltage + 5.0f) / 10.0f * length;
+  }
+  // clamped before the conversion, which is undefined for negative values; NaN lands on the first chord
+  if (!(index >= 0.f)) return 0;
+  if (index >= length) return length - 1;
+  return (size_t) index;
+}
@@ -0,0 +1,228 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// The harmonizer and voicer strategies, the chord table and the pitch/CV conversions.  Nothing in
+// here depends on Rack: it's built into build/libharmony.a, which the plugin, the tests, the benchmark
+// and the tools all link.
+
+
+#define VOLTAGE_UNIPOLAR true
+
+// harmony voices below the melody; callers keep offsets in int[MAX_VOICES] buffers so nothing allocates
+static const int MIN_VOICES = 2;
+static const int MAX_VOICES = 7;
+static const int DEFAULT_VOICES = 3;
+
+// precomputed harmony for one (chord type, melody pitch class relative to root) pair
+struct HarmonyEntry {
+  int8_t offsets[MAX_VOICES];
+  bool chordTone;  // false means the melody is a passing tone and the harmonizer must fall back
+};
+
+// one way of spreading chord tones under the melody, highest voice first
+struct Voicing {
+  int8_t offsets[MAX_VOICES];
+};
+
+// what chord a set of pitch classes spells; -1 for both when the notes don't fit any chord type well enough
+struct ChordMatch {
+  int16_t root;
+  int16_t chordTypeIndex;
+};
+
+// most candidate voicings kept per (chord type, voice count, melody pitch class); bounds the voice-leading scan
+static const size_t MAX_VOICINGS = 64;
+
+
+// chord definitions from res/chords.json; built once and shared read-only by every module and harmonizer
+struct ChordTable {
+  std::vector<std::string> names;
+  std::vector<int> intervals;  // every chord's intervals back to back
+  std::vector<size_t> offsets;  // chord i's intervals are intervals[offsets[i]] up to intervals[offsets[i + 1]]
+  std::vector<HarmonyEntry> harmonyTable;  // 12 entries per chord type, indexed by relative pitch class
+  std::vector<Voicing> voicings;  // candidate voicings, list by list
+  std::vector<size_t> voicingOffsets;  // list k is voicings[voicingOffsets[k]] up to voicings[voicingOffsets[k + 1]]
+  std::vector<ChordMatch> recognitionTable;  // 4096 entries, indexed by 12-bit pitch class mask (bit 0 is C)
+  std::vector<int> scaleMasks;  // each chord's available scale, chord tones included; bit 0 is the root
+  std::vector<HarmonyEntry> scaleTable;  // diatonic passing harmony, laid out like harmonyTable; chordTone means in the scale
+
+  // the scale is optional; without one only the chord tones are in the scale
+  void addChord(const std::string &name, const std::vector<int> &chordInts, const std::vector<int> &scaleInts = std::vector<int>());
+  void buildHarmonyTable();
+  void buildScaleTable();
+  void buildVoicingTable();
+  void buildRecognitionTable();
+  void buildTables();  // all of the above, once every chord is added
+
+  // reads the contents of a chords.json file, for the plugin and the tools alike; on failure returns false and
+  // fills in where it went wrong
+  bool parseJson(const std::string &text, int* errorLine, int* errorColumn, std::string* errorText);
+
+  // the precompiled chords.bin written by tools/chordc: fixed-width little-endian fields at 4-byte aligned
+  // offsets, read from a buffer holding the whole file
+  static bool isBinary(const void* data, size_t size);
+  bool parseBinary(const void* data, size_t size, std::string* errorText);
+  std::string toBinary() const;
+
+  size_t size() const {
+    return names.size();
+  }
+  const int* chordIntervals(size_t chordTypeIndex) const {
+    return intervals.data() + offsets[chordTypeIndex];
+  }
+  size_t numIntervals(size_t chordTypeIndex) const {
+    return offsets[chordTypeIndex + 1] - offsets[chordTypeIndex];
+  }
+  const HarmonyEntry &harmonyEntry(size_t chordTypeIndex, int relativeMelNote) const {
+    return harmonyTable[chordTypeIndex * 12 + relativeMelNote];
+  }
+  const HarmonyEntry &scaleEntry(size_t chordTypeIndex, int relativeMelNote) const {
+    return scaleTable[chordTypeIndex * 12 + relativeMelNote];
+  }
+  const ChordMatch &recognizeChord(int pitchClassMask) const {
+    return recognitionTable[pitchClassMask & 0xfff];
+  }
+  // the candidates for a chord tone melody; empty for passing tones
+  const Voicing* candidateVoicings(size_t chordTypeIndex, int numVoices, int relativeMelNote, size_t* count) const {
+    size_t list = (chordTypeIndex * (MAX_VOICES - MIN_VOICES + 1) + numVoices - MIN_VOICES) * 12 + relativeMelNote;
+    *count = voicingOffsets[list + 1] - voicingOffsets[list];
+    return voicings.data() + voicingOffsets[list];
+  }
+};
+
+
+// small allocation-free PRNG (xoshiro128**), cheap enough to draw from on the audio thread
+struct HarmonyRandom {
+  uint32_t s[4] = {1, 2, 3, 4};
+
+  void seed(uint64_t seed);
+  uint32_t next();
+  int uniformInt(int lo, int hi);  // inclusive at both ends, like std::uniform_int_distribution
+};
+
+
+// per-channel memory of what the harmonizer last did, so one harmonizer can serve every poly channel.  Every
+// harmonizer records each harmony it makes, so switching harmonizers carries on from the voices last played.
+struct HarmonyState {
+  int lastNote = 0;
+  // if the first note after initialization is a passing tone, we'll use a diminished chord like BasicHarmonizer
+  int lastOffsets[MAX_VOICES] = {-3, -6, -9, -12, -15, -18, -21};
+
+  void remember(int melody, const int* offsets, int numVoices) {
+    lastNote = melody;
+    for (int v = 0; v < numVoices; v++) {
+      lastOffsets[v] = offsets[v];
+    }
+  }
+};
+
+
+// interface for the harmonizer strategy - module may switch between strategies
+struct Harmonizer {  // abstract
+  const ChordTable* chords = NULL;  // shared by every module instance; see NestlingAudio::loadChords
+
+  virtual ~Harmonizer() {}
+  virtual void init(const ChordTable* chords);
+  virtual void computeOffsets(size_t chordTypeIndex, int melody, int root, int numVoices, HarmonyState& state, int* offsets) = 0;
+  virtual void _setPassingNoteOffsets(size_t chordTypeIndex, int melody, int root, int numVoices, HarmonyState& state, int* offsets) = 0;
+  virtual std::string displayName() = 0;
+};
+
+struct BasicHarmonizer : Harmonizer {
+  virtual void computeOffsets(size_t chordTypeIndex, int melody, int root, int numVoices, HarmonyState& state, int* offsets) override;
+  virtual void _setPassingNoteOffsets(size_t chordTypeIndex, int melody, int root, int numVoices, HarmonyState& state, int* offsets) override;
+  virtual std::string displayName() override;
+};
+
+struct ParallelHarmonizer : BasicHarmonizer {
+  virtual void _setPassingNoteOffsets(size_t chordTypeIndex, int melody, int root, int numVoices, HarmonyState& state, int* offsets) override;
+  virtual std::string displayName() override;
+};
+
+struct RandomPassingHarmonizer : BasicHarmonizer {
+  HarmonyRandom random;
+
+  virtual void _setPassingNoteOffsets(size_t chordTypeIndex, int melody, int root, int numVoices, HarmonyState& state, int* offsets) override;
+  virtual std::string displayName() override;
+};
+
+
+// harmonizes passing tones in the chord's scale (from the "scale" in chords.json) diatonically, stacking scale
+// thirds down from the melody; notes outside the scale still get diminished harmony
+struct ScaleHarmonizer : BasicHarmonizer {
+  virtual void _setPassingNoteOffsets(size_t chordTypeIndex, int melody, int root, int numVoices, HarmonyState& state, int* offsets) override;
+  virtual std::string displayName() override;
+};
+
+// picks whichever chord tone voicing moves the voices least from the last harmony, so held chords stay put
+// and the voices step smoothly; passing tones fall back to diminished harmony like BasicHarmonizer
+struct VoiceLeadingHarmonizer : BasicHarmonizer {
+  virtual void computeOffsets(size_t chordTypeIndex, int melody, int root, int numVoices, HarmonyState& state, int* offsets) override;
+  virtual std::string displayName() override;
+};
+
+
+// interface for the voicer strategy - module may switch between strategies; offsets come in highest first
+// and leave that way
+struct Voicer {  // abstract
+  virtual ~Voicer() {}
+  virtual void adjustOffsets(int* offsets, int numVoices) = 0;
+  virtual std::string displayName() = 0;
+};
+
+struct CloseVoicer : Voicer {
+  void adjustOffsets(int* offsets, int numVoices) override;
+  virtual std::string displayName() override;
+};
+
+struct DropTwoVoicer : Voicer {
+  void adjustOffsets(int* offsets, int numVoices) override;
+  virtual std::string displayName() override;
+};
+
+struct DropTwoFourVoicer : Voicer {
+  void adjustOffsets(int* offsets, int numVoices) override;
+  virtual std::string displayName() override;
+};
+
+
+// one of every strategy, with the tables of them pointing into the same block; a module owns one by value,
+// so choosing a strategy is an array index, nothing is scattered around the heap and nothing needs freeing
+struct HarmonyStrategies {
+  static const int NUM_HARMONIZERS = 5;
+  static const int NUM_VOICERS = 3;
+
+  BasicHarmonizer basic;
+  ParallelHarmonizer parallel;
+  RandomPassingHarmonizer randomPassing;
+  ScaleHarmonizer scale;
+  VoiceLeadingHarmonizer voiceLeading;
+  CloseVoicer close;
+  DropTwoVoicer dropTwo;
+  DropTwoFourVoicer dropTwoFour;
+
+  // in the order the module's selectors list them
+  Harmonizer* harmonizers[NUM_HARMONIZERS];
+  Voicer* voicers[NUM_VOICERS];
+
+  HarmonyStrategies();
+  void init(const ChordTable* chords);
+
+  // the tables point into this object, so a copy would point into the original
+  HarmonyStrategies(const HarmonyStrategies&) = delete;
+  HarmonyStrategies& operator=(const HarmonyStrategies&) = delete;
+};
+
+
+// pitch and CV conversions; midi note 60 (C4) is 0v
+struct HarmonyCV {
+  static int cvToMidi(const float voltage);
+  static float midiToCV(const int midi);
+  static std::string midiToString(const int midi);
+  static int voiceNote(const int melody, const int offset);  // a voice that would fall below note 0 doubles the melody
+  static size_t cvToIndex(const float voltage, const size_t length);
+};
@@ -0,0 +1,148 @@
+#include "plugin.hpp"
+#include "Harmony.hpp"
+#include "ChordMessage.hpp"
+
+
+// how long CHANGE_OUTPUT stays high, in seconds
+static const float CHANGE_TRIGGER_SECONDS = 1e-3f;
+
+
+// Expander for the right side of Jazz: the rest of the chord Jazz is harmonizing against, one channel per melody
+// channel.  Everything comes from the ChordMessage, so there's no chord table here, and the message goes on
+// unchanged to any expander on this one's right.
+struct NestlingAudio_ChordOut : Module, HarmonyCV {
+	enum ParamId {
+		PARAMS_LEN
+	};
+	enum InputId {
+		INPUTS_LEN
+	};
+	enum OutputId {
+		ROOT_OUTPUT,
+		THIRD_OUTPUT,
+		FIFTH_OUTPUT,
+		SEVENTH_OUTPUT,
+		BASS_OUTPUT,
+		CHORD_OUTPUT,
+		CHANGE_OUTPUT,
+		OUTPUTS_LEN
+	};
+	enum LightId {
+		LIGHTS_LEN
+	};
+
+  // Rack flips these between the module on the left writing one and this module reading the other
+  ChordMessage messages[2] = {};
+  uint32_t lastSequence = 0;
+  bool linked = false;
+  simd::float_4 changeRemaining[PORT_MAX_CHANNELS / 4];
+
+	NestlingAudio_ChordOut() {
+		config(PARAMS_LEN, INPUTS_LEN, OUTPUTS_LEN, LIGHTS_LEN);
+		configOutput(ROOT_OUTPUT, "chord root: 1v/oct");
+		configOutput(THIRD_OUTPUT, "chord's second note (the third, or the suspension): 1v/oct");
+		configOutput(FIFTH_OUTPUT, "chord's third note (usually the fifth): 1v/oct");
+		configOutput(SEVENTH_OUTPUT, "chord's fourth note (usually the seventh): 1v/oct");
+		configOutput(BASS_OUTPUT, "bass: the chord root, an octave or more below the lowest harmony voice: 1v/oct");
+		configOutput(CHORD_OUTPUT, "full chord: 1v/oct, one channel per chord note (melody channel 1's chord first, up to 16)");
+		configOutput(CHANGE_OUTPUT, "trigger out when the root or chord type changes");
+
+    leftExpander.producerMessage = &messages[0];
+    leftExpander.consumerMessage = &messages[1];
+    for (int g = 0; g < PORT_MAX_CHANNELS / 4; g++) {
+      changeRemaining[g] = 0.f;
+    }
+	}
+
+	void process(const ProcessArgs& args) override {
+    const ChordMessage* message = receiveChordMessage(this);
+    if (message) {
+      if (message->sequence != lastSequence) {
+        lastSequence = message->sequence;
+        linked = true;
+        applyMessage(*message);
+        forwardChordMessage(this, *message);
+      }
+    } else if (linked) {
+      // unplugged from the chain: go quiet rather than hold the last chord
+      linked = false;
+      lastSequence = 0;
+      for (int i = 0; i < OUTPUTS_LEN; i++) {
+        outputs[i].setChannels(0);
+      }
+    }
+
+    int channels = outputs[CHANGE_OUTPUT].getChannels();
+    for (int c = 0; c < channels; c += 4) {
+      outputs[CHANGE_OUTPUT].setVoltageSimd(simd::ifelse(changeRemaining[c / 4] > 0.f, 10.f, 0.f), c);
+      changeRemaining[c / 4] = simd::fmax(changeRemaining[c / 4] - args.sampleTime, 0.f);
+    }
+	}
+
+  // only runs when Jazz has harmonized since the last message; outputs hold their voltages in between
+  void applyMessage(const ChordMessage &message) {
+    int channels = std::max(0, std::min((int) message.channels, PORT_MAX_CHANNELS));
+    int chordChannel = 0;
+    for (int ch = 0; ch < channels; ch++) {
+      int numTones = std::max(1, std::min((int) message.numChordTones[ch], MAX_CHORD_TONES));
+      const int8_t* tones = message.chordTones[ch];
+      // chord notes an octave above the root sub on Jazz's ROOT_OUTPUT; a chord with fewer notes repeats its root
+      int root = message.root[ch] + 48;
+      outputs[ROOT_OUTPUT].setVoltage(midiToCV(root), ch);
+      outputs[THIRD_OUTPUT].setVoltage(midiToCV(root + (numTones > 1 ? tones[1] : 0)), ch);
+      outputs[FIFTH_OUTPUT].setVoltage(midiToCV(root + (numTones > 2 ? tones[2] : 0)), ch);
+      outputs[SEVENTH_OUTPUT].setVoltage(midiToCV(root + (numTones > 3 ? tones[3] : 0)), ch);
+
+      int lowest = message.melody[ch];
+      for (int v = 0; v < message.numVoices && v < MAX_VOICES; v++) {
+        lowest = std::min(lowest, message.melody[ch] + message.offsets[ch][v]);
+      }
+      outputs[BASS_OUTPUT].setVoltage(midiToCV(bassNote(message.root[ch], lowest)), ch);
+
+      for (int k = 0; k < numTones && chordChannel < PORT_MAX_CHANNELS; k++) {
+        outputs[CHORD_OUTPUT].setVoltage(midiToCV(root + tones[k]), chordChannel++);
+      }
+
+      if (message.changed & (1u << ch)) {
+        changeRemaining[ch / 4][ch % 4] = CHANGE_TRIGGER_SECONDS;
+      }
+    }
+
+    outputs[ROOT_OUTPUT].setChannels(channels);
+    outputs[THIRD_OUTPUT].setChannels(channels);
+    outputs[FIFTH_OUTPUT].setChannels(channels);
+    outputs[SEVENTH_OUTPUT].setChannels(channels);
+    outputs[BASS_OUTPUT].setChannels(channels);
+    outputs[CHORD_OUTPUT].setChannels(chordChannel);
+    outputs[CHANGE_OUTPUT].setChannels(channels);
+  }
+
+  // the highest root at least an octave below the lowest voice, so the bass follows the harmony's register
+  static int bassNote(int rootPitchClass, int lowest) {
+    int bass = lowest - 12 - (((lowest - 12 - rootPitchClass) % 12 + 12) % 12);
+    while (bass < 0) bass += 12;
+    return bass;
+  }
+};
+
+
+struct NestlingAudio_ChordOutWidget : ModuleWidget {
+	NestlingAudio_ChordOutWidget(NestlingAudio_ChordOut* module) {
+		setModule(module);
+		setPanel(createPanel(asset::plugin(pluginInstance, "res/NestlingAudio-ChordOut.svg")));
+
+		addChild(createWidget<ScrewSilver>(Vec(RACK_GRID_WIDTH, 0)));
+		addChild(createWidget<ScrewSilver>(Vec(RACK_GRID_WIDTH, RACK_GRID_HEIGHT - RACK_GRID_WIDTH)));
+
+		addOutput(createOutputCentered<PJ301MPort>(mm2px(Vec(10.16, 22.0)), module, NestlingAudio_ChordOut::ROOT_OUTPUT));
+		addOutput(createOutputCentered<PJ301MPort>(mm2px(Vec(10.16, 34.0)), module, NestlingAudio_ChordOut::THIRD_OUTPUT));
+		addOutput(createOutputCentered<PJ301MPort>(mm2px(Vec(10.16, 46.0)), module, NestlingAudio_ChordOut::FIFTH_OUTPUT));
+		addOutput(createOutputCentered<PJ301MPort>(mm2px(Vec(10.16, 58.0)), module, NestlingAudio_ChordOut::SEVENTH_OUTPUT));
+		addOutput(createOutputCentered<PJ301MPort>(mm2px(Vec(10.16, 72.0)), module, NestlingAudio_ChordOut::BASS_OUTPUT));
+		addOutput(createOutputCentered<PJ301MPort>(mm2px(Vec(10.16, 86.0)), module, NestlingAudio_ChordOut::CHORD_OUTPUT));
+		addOutput(createOutputCentered<PJ301MPort>(mm2px(Vec(10.16, 100.0)), module, NestlingAudio_ChordOut::CHANGE_OUTPUT));
+	}
+};
+
+
+Model* modelNestlingAudio_ChordOut = createModel<NestlingAudio_ChordOut, NestlingAudio_ChordOutWidget>("NestlingAudio-ChordOut");
@@ -1,5 +1,9 @@
 #include "plugin.hpp"
 #include "NestlingAudio.hpp"
+#include "SnapshotBuffer.hpp"
+#include "ChordMessage.hpp"
+#include <atomic>
+#include <chrono>
 
 
 struct LabelQuantity : ParamQuantity {
@@ -17,103 +21,16 @@ struct LabelQuantity : ParamQuantity {
 	}
 };
 
-struct ParallelHarmonizer : BasicHarmonizer {
-  int* lastOffsets;
-  virtual void init(std::vector<std::vector<int>> &chordIntervals) override {
-    BasicHarmonizer::init(chordIntervals);
-    lastOffsets = new int[3];
-    // if the first note after initialization is a passing tone, we'll use a diminished chord like BasicHarmonizer
-    lastOffsets[0] = -3;
-    lastOffsets[1] = -6;
-    lastOffsets[2] = -9;
-  }
-  virtual void _setPassingNoteOffsets(size_t chordTypeIndex, int melody, int root, int* offsets) override {
-    offsets[0] = lastOffsets[0];
-    offsets[1] = lastOffsets[1];
-    offsets[2] = lastOffsets[2];
-  }
-  virtual void computeOffsets(size_t chordTypeIndex, int melody, int root, int* offsets) override {
-    BasicHarmonizer::computeOffsets(chordTypeIndex, melody, root, offsets);
-    lastOffsets[0] = offsets[0];
-    lastOffsets[1] = offsets[1];
-    lastOffsets[2] = offsets[2];
-  }
-  virtual std::string displayName() override {
-    return "Parallel Passing";
-  }
-};
+// how often the harmony pipeline runs, in samples; 1 is every sample
+static const int CONTROL_RATE_DIVISIONS[] = {1, 16, 32, 64};
+static const int NUM_CONTROL_RATES = 4;
 
-struct RandomPassingHarmonizer : BasicHarmonizer {
-  int lastNote = 0;
-  int* lastOffsets;
+// how long the trigger outputs stay high, in milliseconds
+static const float TRIGGER_WIDTHS_MS[] = {1.f, 2.f, 5.f, 10.f};
+static const int NUM_TRIGGER_WIDTHS = 4;
 
-  virtual void init(std::vector<std::vector<int>> &chordIntervals) override {
-    BasicHarmonizer::init(chordIntervals);
-    lastOffsets = new int[3];
-  }
- 
-  virtual void computeOffsets(size_t chordTypeIndex, int melody, int root, int* offsets) override {
-    BasicHarmonizer::computeOffsets(chordTypeIndex, melody, root, offsets);
-    lastNote = melody;
-  }
-  virtual void _setPassingNoteOffsets(size_t chordTypeIndex, int melody, int root, int* offsets) override {
-    if (melody == lastNote) {
-      offsets[0] = lastOffsets[0];
-      offsets[1] = lastOffsets[1];
-      offsets[2] = lastOffsets[2];
-      return;
-    }
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> third_distr(2, 5);  // M2 through P4
-    int third = third_distr(gen);
-
-    std::uniform_int_distribution<> fifth_distr(third == 5 ? 7 : 6, 8);  // D5, P5 or A5
-    int fifth = fifth_distr(gen);
-
-    std::uniform_int_distribution<> seventh_distr(fifth == 8 ? 10 : 9, 11);  // M6 thru M7
-    int seventh = seventh_distr(gen);
-
-    int possibleOffsets[4] = {0, third, fifth, seventh};
-
-    INFO("possibleOffsets initial: %d, %d, %d, %d\n", 0, third, fifth, seventh);
-    std::uniform_int_distribution<> idx_distr(0, 3);
-    int melIndex = idx_distr(gen);
-    int delta = possibleOffsets[melIndex];
-    possibleOffsets[0] -= delta;
-    possibleOffsets[1] -= delta;
-    possibleOffsets[2] -= delta;
-    possibleOffsets[3] -= delta;
-    INFO("possibleOffsets after delta: %d, %d, %d, %d\n", 
-        possibleOffsets[0],
-        possibleOffsets[1],
-        possibleOffsets[2],
-        possibleOffsets[3]);
-    // TODO: there's some common-ish code between here and BasicHarmonizer::computeOffsets, write unit tests and refactor
-    int j = melIndex - 1;
-    j = (j + 4) % 4;
-    INFO("0: j, j%%4, po[j%%4], po[j%%4]%%12: %d, %d, %d, %d \n", j, j%4, possibleOffsets[j%4], possibleOffsets[j % 4] % 12);
-    offsets[0] = (possibleOffsets[j % 4] % 12);
-    if (offsets[0] >= 0) offsets[0] -= 12;
-    j--;
-    j = (j + 4) % 4;
-    INFO("1: j, j%%4, po[j%%4], po[j%%4]%%12: %d, %d, %d, %d \n", j, j%4, possibleOffsets[j%4], possibleOffsets[j % 4] % 12);
-    offsets[1] = (possibleOffsets[j % 4] % 12);
-    if (offsets[1] >= 0) offsets[1] -= 12;
-    j--;
-    j = (j + 4) % 4;
-    INFO("2: j, j%%4, po[j%%4], po[j%%4]%%12: %d, %d, %d, %d \n", j, j%4, possibleOffsets[j%4], possibleOffsets[j % 4] % 12);
-    offsets[2] = (possibleOffsets[j % 4] % 12);
-    if (offsets[2] >= 0) offsets[2] -= 12;
-    INFO("offsets: %d, %d, %d\n", offsets[0], offsets[1], offsets[2]);
-    lastOffsets[0] = offsets[0];;
-    lastOffsets[1] = offsets[1];
-    lastOffsets[2] = offsets[2];
-  }
-  virtual std::string displayName() override {
-    return "Random Passing";
-  }
-};
+// samples between diagnostics updates, and the span the process time figures cover
+static const int DIAGNOSTICS_WINDOW = 4096;
 
 struct NestlingAudio_Jazz : NestlingAudio {
 	enum ParamId {
@@ -139,16 +56,83 @@ struct NestlingAudio_Jazz : NestlingAudio {
     ROOT_OUTPUT,
     TRIG_OUTPUT,
     MEL_8VA_OUTPUT,
+    POLY_OUTPUT,
+    VOICE_TRIG_OUTPUT,
 		OUTPUTS_LEN
 	};
 	enum LightId {
 		LIGHTS_LEN
 	};
 
-  std::vector<Harmonizer*> harmonizers;
-  std::vector<Voicer*> voicers;
-  int lastMelNote;
-  bool lastGate;
+  HarmonyStrategies strategies;
+  int lastMelNote[PORT_MAX_CHANNELS] = {};
+  int lastGateBits[PORT_MAX_CHANNELS / 4] = {};  // one bit per channel, four channels per entry
+  int lastChannels = 0;
+  HarmonyState harmonyStates[PORT_MAX_CHANNELS];
+
+  // the context menu and patch settings.  The UI thread owns `settings` and publishes a copy after every
+  // change; the audio thread takes the latest copy at the top of process(), so a change never lands partway
+  // through a pass over the channels
+  struct Settings {
+    int numVoices = DEFAULT_VOICES;  // harmony voices per melody note; OUT1-OUT3 carry the first three, POLY_OUTPUT all
+    int triggerWidthIndex = 0;
+    int controlRateIndex = 0;  // harmony runs every CONTROL_RATE_DIVISIONS[i] samples, or at once on a gate edge
+    bool chordRecognition = false;  // the notes on the root input name the chord, for every melody channel
+    uint32_t randomSeed = 0;  // for the random passing harmonizer
+    uint32_t reseedCount = 0;  // bumped by every setRandomSeed, so reseeding with the same seed restarts the sequence
+    bool measureTime = false;  // time every process() call for the diagnostics; costs two clock reads a sample
+    uint32_t resetCount = 0;  // bumped to zero the diagnostics
+  };
+  Settings settings;
+  SnapshotBuffer<Settings> settingsBuffer;
+  bool fixedSeed = false;  // a fixed seed is saved with the patch so renders repeat
+
+  // audio thread: what has been applied from the settings snapshot
+  int lastNumVoices = DEFAULT_VOICES;
+  int appliedControlRateIndex = -1;
+  uint32_t appliedReseedCount = 0;
+  uint32_t appliedResetCount = 0;
+  dsp::ClockDivider controlDivider;
+
+  // counters for finding expensive instances in a big patch.  The audio thread counts into `diagnostics` and
+  // publishes a copy every DIAGNOSTICS_WINDOW samples, which the UI thread reads without locking.
+  struct Diagnostics {
+    uint64_t samples = 0;
+    uint64_t harmonyPasses = 0;  // samples the harmony pipeline ran on; it skipped the rest
+    uint64_t recomputedNotes = 0;  // melody channels harmonized again
+    uint64_t passingTones[HarmonyStrategies::NUM_HARMONIZERS] = {};  // recomputed notes that were passing tones
+    // process() time over the last window, when measuring is on
+    bool timed = false;
+    float minMicros = 0.f;
+    float avgMicros = 0.f;
+    float maxMicros = 0.f;
+  };
+  Diagnostics diagnostics;
+  SnapshotBuffer<Diagnostics> diagnosticsBuffer;
+  int windowSamples = 0;
+  int windowTimed = 0;
+  double windowMin = 0.0;
+  double windowMax = 0.0;
+  double windowTotal = 0.0;
+
+  // triggers fire when a voice's note number changes (-1 before the first note), and last the trigger width
+  // at any sample rate; the pulse timers hold four channels per entry
+  int lastHarmonyNotes[PORT_MAX_CHANNELS][MAX_VOICES];
+  simd::float_4 trigRemaining[PORT_MAX_CHANNELS / 4];
+  simd::float_4 voiceTrigRemaining[PORT_MAX_CHANNELS / 4];
+
+  int chordMask = 0;
+  ChordMatch recognizedChord = {-1, -1};
+
+  // what the last ChordMessage said each channel's chord was, for the next one's change flags
+  int sentRoot[PORT_MAX_CHANNELS];
+  int sentChordTypeIndex[PORT_MAX_CHANNELS];
+  uint32_t chordMessageSequence = 0;
+
+  // the value each selector is actually using, whether it came from its knob or from CV (channel 0 for
+  // poly CV); written by the audio thread, read by the widget and display at frame rate.  Each value stands on
+  // its own, so relaxed loads and stores are enough
+  std::atomic<int> effectiveValues[PARAMS_LEN];
 
 	NestlingAudio_Jazz() {
 		config(PARAMS_LEN, INPUTS_LEN, OUTPUTS_LEN, LIGHTS_LEN);
@@ -158,179 +142,609 @@ struct NestlingAudio_Jazz : NestlingAudio {
     ((LabelQuantity*)getParamQuantity(ROOT_PARAM))->setLabels(noteNames);
 
 		loadChords();
-		configParam<LabelQuantity>(CHORD_PARAM, 0.f, (float) (chordNames.size() - 1), 2.f, "chord type");
-    ((LabelQuantity*)getParamQuantity(CHORD_PARAM))->setLabels(chordNames);
+		configParam<LabelQuantity>(CHORD_PARAM, 0.f, (float) (chords->size() - 1), 2.f, "chord type");
+    ((LabelQuantity*)getParamQuantity(CHORD_PARAM))->setLabels(chords->names);
+
+    strategies.init(chords);
+    setRandomSeed(random::u32());
 
 		std::vector<std::string> harmonizerNames;
-    Harmonizer* harm;
-    harm = new BasicHarmonizer();
-    harm->init(chordIntervals);
-    harmonizers.push_back(harm);
-    harmonizerNames.push_back(harm->displayName());
-    harm = new ParallelHarmonizer();
-    harm->init(chordIntervals);
-    harmonizers.push_back(harm);
-    harmonizerNames.push_back(harm->displayName());
-    harm = new RandomPassingHarmonizer();
-    harm->init(chordIntervals);
-    harmonizers.push_back(harm);
-    harmonizerNames.push_back(harm->displayName());
-		configParam<LabelQuantity>(HARMONY_PARAM, 0.f, (float) (harmonizers.size() - 1), 0.f, "harmonizer type");
+    for (Harmonizer* harmonizer : strategies.harmonizers) {
+      harmonizerNames.push_back(harmonizer->displayName());
+    }
+		configParam<LabelQuantity>(HARMONY_PARAM, 0.f, (float) (HarmonyStrategies::NUM_HARMONIZERS - 1), 0.f, "harmonizer type");
     ((LabelQuantity*)getParamQuantity(HARMONY_PARAM))->setLabels(harmonizerNames);
 
 		std::vector<std::string> voicerNames;
-    Voicer* voic;
-    voic = new CloseVoicer();
-    voicers.push_back(voic);
-    voicerNames.push_back(voic->displayName());
-    voic = new DropTwoVoicer();
-    voicers.push_back(voic);
-    voicerNames.push_back(voic->displayName());
-    voic = new DropTwoFourVoicer();
-    voicers.push_back(voic);
-    voicerNames.push_back(voic->displayName());
-    assert(voicers.size() == 3);
-    assert(voicerNames.size() == 3);
+    for (Voicer* voicer : strategies.voicers) {
+      voicerNames.push_back(voicer->displayName());
+    }
+    static_assert(HarmonyStrategies::NUM_VOICERS == 3, "voicing switch needs one position per voicer");
 		configParam<LabelQuantity>(VOICING_PARAM, 0.f, 2.f, 0.f, "voicing");
     ((LabelQuantity*)getParamQuantity(VOICING_PARAM))->setLabels(voicerNames);
 
-		configInput(ROOT_INPUT, "chord root: 1v/oct");
-		configInput(CHORD_INPUT, "chord type: 0v to 10v");  // TODO: change if we make this configurable
+		configInput(ROOT_INPUT, "chord root: 1v/oct (mono, or poly to follow the melody channels; the chord's notes in chord recognition mode)");
+		configInput(CHORD_INPUT, "chord type: 0v to 10v (mono or poly)");  // TODO: change if we make this configurable
 		configInput(HARMONY_INPUT, "harmonizer type: 0v to 10v");  // TODO: change if we make this configurable
 		configInput(VOICING_INPUT, "voicing: 0v to 10v");  // TODO: change if we make this configurable
-		configInput(MEL_INPUT, "melody note in: 1v/oct");
+		configInput(MEL_INPUT, "melody note in: 1v/oct (up to 16 channels)");
 		configInput(GATE_INPUT, "gate in (affects tie behavior)");
 		configOutput(OUT1_OUTPUT, "harmony note 1: 1v/oct");
 		configOutput(OUT2_OUTPUT, "harmony note 2: 1v/oct");
 		configOutput(OUT3_OUTPUT, "harmony note 3: 1v/oct");
 		configOutput(ROOT_OUTPUT, "root sub: 1v/oct");
-		configOutput(TRIG_OUTPUT, "trigger out when other outs change");
+		configOutput(TRIG_OUTPUT, "trigger out when any harmony note changes");
 		configOutput(MEL_8VA_OUTPUT, "melody note 8va out: 1v/oct");
+		configOutput(POLY_OUTPUT, "all harmony notes: 1v/oct, one channel per voice (melody channel 1's voices first, up to 16)");
+		configOutput(VOICE_TRIG_OUTPUT, "harmony voice triggers: one channel per voice, like the poly out");
+
+    for (int ch = 0; ch < PORT_MAX_CHANNELS; ch++) {
+      std::fill(lastHarmonyNotes[ch], lastHarmonyNotes[ch] + MAX_VOICES, -1);
+      sentRoot[ch] = -1;
+      sentChordTypeIndex[ch] = -1;
+    }
+    for (int g = 0; g < PORT_MAX_CHANNELS / 4; g++) {
+      trigRemaining[g] = 0.f;
+      voiceTrigRemaining[g] = 0.f;
+    }
+
+    for (int i = 0; i < PARAMS_LEN; i++) {
+      effectiveValues[i].store((int) params[i].getValue(), std::memory_order_relaxed);
+    }
+    publishSettings();
 	}
 
+  void setEffectiveValue(int paramId, int value) {
+    effectiveValues[paramId].store(value, std::memory_order_relaxed);
+  }
+
+  int getEffectiveValue(int paramId) const {
+    return effectiveValues[paramId].load(std::memory_order_relaxed);
+  }
+
 	void process(const ProcessArgs& args) override {
-    // INPUT
-		size_t chordTypeIndex;
-		if (inputs[CHORD_INPUT].isConnected()) {
-    	chordTypeIndex = cvToIndex(inputs[CHORD_INPUT].getVoltage(), chordNames.size());
-      getParamQuantity(CHORD_PARAM)->setValue(chordTypeIndex);
-		} else {
-			chordTypeIndex = (size_t) params[CHORD_PARAM].getValue();
-		}
+    // new settings take over here, between samples
+    if (settingsBuffer.update()) {
+      applySettings();
+    }
+    const Settings &active = settingsBuffer.read();
+
+    if (active.measureTime) {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      processFrame(args, active);
+      recordProcessTime(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+    } else {
+      processFrame(args, active);
+    }
 
-		int rootBase;
-		if (inputs[ROOT_INPUT].isConnected()) {
-			float rootVoltage = inputs[ROOT_INPUT].getVoltage();
-			rootBase = cvToMidi(rootVoltage) % 12;
-      getParamQuantity(ROOT_PARAM)->setValue(rootBase);
-		} else {
-			rootBase = ((int) params[ROOT_PARAM].getValue()) % 12;
-		}
+    diagnostics.samples++;
+    if (++windowSamples == DIAGNOSTICS_WINDOW) {
+      publishDiagnostics();
+    }
+  }
+
+  void processFrame(const ProcessArgs& args, const Settings &active) {
+    // so does a reloaded chord table, which harmonizes every note again
+    bool chordsChanged = updateChords();
+    if (chordsChanged) {
+      strategies.init(chords);
+      recognizedChord = {-1, -1};
+    }
+
+    // one set of outputs per melody channel; root and chord may be mono or follow the melody channels
+    int channels = std::max(1, inputs[MEL_INPUT].getChannels());
+
+    // gate edges are checked every sample so a new note is harmonized on the sample it arrives
+    int gateRises[PORT_MAX_CHANNELS / 4] = {};
+    bool anyGateRise = false;
+    for (int c = 0; c < channels; c += 4) {
+      int gateBits = simd::movemask(inputs[GATE_INPUT].getPolyVoltageSimd<simd::float_4>(c) > 5.f);
+      if (channels - c < 4) gateBits &= (1 << (channels - c)) - 1;
+      gateRises[c / 4] = gateBits & ~lastGateBits[c / 4];
+      lastGateBits[c / 4] = gateBits;
+      if (gateRises[c / 4]) anyGateRise = true;
+    }
+
+    int voices = active.numVoices;
+    bool controlTick = controlDivider.process();
+    // a new voice count or chord table changes every note, tied or not
+    bool recomputeAll = voices != lastNumVoices || chordsChanged;
+    if (controlTick || anyGateRise || channels != lastChannels || recomputeAll) {
+      processHarmony(active, channels, voices, gateRises, recomputeAll);
+    }
+    lastChannels = channels;
+    lastNumVoices = voices;
+
+    int voiceChannels = std::min(PORT_MAX_CHANNELS, channels * voices);
+    for (int c = 0; c < channels; c += 4) {
+      outputs[TRIG_OUTPUT].setVoltageSimd(simd::ifelse(trigRemaining[c / 4] > 0.f, 10.f, 0.f), c);
+      trigRemaining[c / 4] = simd::fmax(trigRemaining[c / 4] - args.sampleTime, 0.f);
+    }
+    for (int c = 0; c < voiceChannels; c += 4) {
+      outputs[VOICE_TRIG_OUTPUT].setVoltageSimd(simd::ifelse(voiceTrigRemaining[c / 4] > 0.f, 10.f, 0.f), c);
+      voiceTrigRemaining[c / 4] = simd::fmax(voiceTrigRemaining[c / 4] - args.sampleTime, 0.f);
+    }
+
+    for (int c = 0; c < channels; c += 4) {
+      outputs[MEL_8VA_OUTPUT].setVoltageSimd(inputs[MEL_INPUT].getVoltageSimd<simd::float_4>(c) + 1.0f, c);
+    }
+
+    outputs[OUT1_OUTPUT].setChannels(channels);
+    outputs[OUT2_OUTPUT].setChannels(channels);
+    outputs[OUT3_OUTPUT].setChannels(channels);
+    outputs[ROOT_OUTPUT].setChannels(channels);
+    outputs[TRIG_OUTPUT].setChannels(channels);
+    outputs[MEL_8VA_OUTPUT].setChannels(channels);
+    outputs[POLY_OUTPUT].setChannels(voiceChannels);
+    outputs[VOICE_TRIG_OUTPUT].setChannels(voiceChannels);
+	}
 
+  // read the chord and strategy selectors, harmonize and voice each channel, and write the harmony outputs
+  void processHarmony(const Settings &active, int channels, int voices, const int* gateRises, bool recomputeAll) {
+    diagnostics.harmonyPasses++;
     size_t harmonizerIndex;
 		if (inputs[HARMONY_INPUT].isConnected()) {
-    	harmonizerIndex = cvToIndex(inputs[HARMONY_INPUT].getVoltage(), harmonizers.size());
-      getParamQuantity(HARMONY_PARAM)->setValue(harmonizerIndex);
+    	harmonizerIndex = cvToIndex(inputs[HARMONY_INPUT].getVoltage(), HarmonyStrategies::NUM_HARMONIZERS);
 		} else {
 			harmonizerIndex = (size_t) params[HARMONY_PARAM].getValue();
 		}
+    setEffectiveValue(HARMONY_PARAM, harmonizerIndex);
 
     size_t voicerIndex;
 		if (inputs[VOICING_INPUT].isConnected()) {
-    	voicerIndex = cvToIndex(inputs[VOICING_INPUT].getVoltage(), voicers.size());
-      getParamQuantity(VOICING_PARAM)->setValue(voicerIndex);
+    	voicerIndex = cvToIndex(inputs[VOICING_INPUT].getVoltage(), HarmonyStrategies::NUM_VOICERS);
 		} else {
 			voicerIndex = (size_t) params[VOICING_PARAM].getValue();
 		}
+    setEffectiveValue(VOICING_PARAM, voicerIndex);
+    Harmonizer* harmonizer = strategies.harmonizers[harmonizerIndex];
+    Voicer* voicer = strategies.voicers[voicerIndex];
+
+    // an expander on the right gets this pass's chords; it passes them along the chain itself, so this is
+    // one message however many there are, and one pointer check when there are none
+    ChordMessage* message = NULL;
+    if (isChordExpander(rightExpander.module)) {
+      message = (ChordMessage*) rightExpander.module->leftExpander.producerMessage;
+      message->changed = 0;
+    }
 
-    float melVoltage = inputs[MEL_INPUT].getVoltage();
-    int melNote = cvToMidi(melVoltage);
-    float gateVoltage = inputs[GATE_INPUT].getVoltage();
-    bool gate = (gateVoltage > 5.f);
-
-    bool outsChanged = false;
-    float oldVoltage1 = outputs[OUT1_OUTPUT].getVoltage();
-    float oldVoltage2 = outputs[OUT2_OUTPUT].getVoltage();
-    float oldVoltage3 = outputs[OUT3_OUTPUT].getVoltage();
-    if (!inputs[GATE_INPUT].isConnected() || lastMelNote != melNote || (gate && !lastGate)) {
-      // ALGORITHM
-      int offsets[3];
-      harmonizers[harmonizerIndex]->computeOffsets(chordTypeIndex, melNote, rootBase, offsets);
-      voicers[voicerIndex]->adjustOffsets(offsets);
+    bool recognizing = active.chordRecognition && inputs[ROOT_INPUT].isConnected();
+    if (recognizing) {
+      updateRecognizedChord();
+    }
+
+    bool gateConnected = inputs[GATE_INPUT].isConnected();
+    float quantizerHysteresis = hysteresis();
+    // the knob's range only catches up with a reloaded table at the next UI frame
+    size_t lastChord = chords->size() - 1;
+    float triggerWidth = TRIGGER_WIDTHS_MS[active.triggerWidthIndex] / 1000.f;
+    for (int c = 0; c < channels; c += 4) {
+      // INPUT
+      simd::float_4 chordTypeIndex;
+      if (recognizing) {
+        chordTypeIndex = (float) recognizedChord.chordTypeIndex;
+      } else if (inputs[CHORD_INPUT].isConnected()) {
+        chordTypeIndex = cvToIndex(inputs[CHORD_INPUT].getPolyVoltageSimd<simd::float_4>(c), chords->size());
+      } else {
+        chordTypeIndex = (float) std::min((size_t) params[CHORD_PARAM].getValue(), lastChord);
+      }
+      if (c == 0) setEffectiveValue(CHORD_PARAM, chordTypeIndex[0]);
+
+      simd::float_4 rootBase;
+      if (recognizing) {
+        rootBase = (float) recognizedChord.root;
+      } else if (inputs[ROOT_INPUT].isConnected()) {
+        rootBase = pitchClass(rootQuantizer.process(inputs[ROOT_INPUT].getPolyVoltageSimd<simd::float_4>(c), c, quantizerHysteresis));
+      } else {
+        rootBase = (float) (((int) params[ROOT_PARAM].getValue()) % 12);
+      }
+      if (c == 0) setEffectiveValue(ROOT_PARAM, rootBase[0]);
+
+      simd::float_4 melNote = melQuantizer.process(inputs[MEL_INPUT].getVoltageSimd<simd::float_4>(c), c, quantizerHysteresis);
+
+      simd::float_4 oldVoltage1 = outputs[OUT1_OUTPUT].getVoltageSimd<simd::float_4>(c);
+      simd::float_4 oldVoltage2 = outputs[OUT2_OUTPUT].getVoltageSimd<simd::float_4>(c);
+      simd::float_4 oldVoltage3 = outputs[OUT3_OUTPUT].getVoltageSimd<simd::float_4>(c);
+      simd::float_4 out1Note = 0.f;
+      simd::float_4 out2Note = 0.f;
+      simd::float_4 out3Note = 60.f;  // 0v when there are only two voices
+      simd::float_4 recomputed = 0.f;
+      for (int i = 0; i < 4 && c + i < channels; i++) {
+        int ch = c + i;
+        int note = (int) melNote[i];
+        bool gateRise = gateRises[c / 4] & (1 << i);
+        if (!gateConnected || lastMelNote[ch] != note || gateRise || recomputeAll) {
+          // ALGORITHM
+          int offsets[MAX_VOICES];
+          harmonizer->computeOffsets((size_t) chordTypeIndex[i], note, (int) rootBase[i], voices, harmonyStates[ch], offsets);
+          voicer->adjustOffsets(offsets, voices);
+          diagnostics.recomputedNotes++;
+          int relativeMelNote = ((note - (int) rootBase[i]) % 12 + 12) % 12;
+          if (!chords->harmonyEntry((size_t) chordTypeIndex[i], relativeMelNote).chordTone) {
+            diagnostics.passingTones[harmonizerIndex]++;
+          }
+
+          for (int v = 0; v < voices; v++) {
+            int harmonyNote = voiceNote(note, offsets[v]);
+            if (v == 0) out1Note[i] = harmonyNote;
+            if (v == 1) out2Note[i] = harmonyNote;
+            if (v == 2) out3Note[i] = harmonyNote;
+
+            int polyChannel = ch * voices + v;
+            bool onPoly = polyChannel < PORT_MAX_CHANNELS;
+            if (onPoly) outputs[POLY_OUTPUT].setVoltage(midiToCV(harmonyNote), polyChannel);
+            if (harmonyNote != lastHarmonyNotes[ch][v]) {
+              lastHarmonyNotes[ch][v] = harmonyNote;
+              trigRemaining[c / 4][i] = triggerWidth;
+              if (onPoly) voiceTrigRemaining[polyChannel / 4][polyChannel % 4] = triggerWidth;
+            }
+          }
+          recomputed[i] = 1.f;
+        }
+        lastMelNote[ch] = note;
+        if (message) writeChordMessage(*message, ch, (int) rootBase[i], (size_t) chordTypeIndex[i], note, voices);
+      }
 
       // OUTPUT
-      int out1Note = melNote + offsets[0];
-      if (out1Note < 0) out1Note = melNote;
-      int out2Note = melNote + offsets[1];
-      if (out2Note < 0) out2Note = melNote;
-      int out3Note = melNote + offsets[2];
-      if (out3Note < 0) out3Note = melNote;
-      assert(out1Note >= 0);
-      assert(out2Note >= 0);
-      assert(out3Note >= 0);
-
-      float newVoltage1 = midiToCV(out1Note);
-      float newVoltage2 = midiToCV(out2Note);
-      float newVoltage3 = midiToCV(out3Note);
-      outputs[OUT1_OUTPUT].setVoltage(newVoltage1);
-      outputs[OUT2_OUTPUT].setVoltage(newVoltage2);
-      outputs[OUT3_OUTPUT].setVoltage(newVoltage3);
-      if (oldVoltage1 != newVoltage1) outsChanged = true;
-      if (oldVoltage2 != newVoltage2) outsChanged = true;
-      if (oldVoltage3 != newVoltage3) outsChanged = true;
-    }
-    outputs[TRIG_OUTPUT].setVoltage(outsChanged ? 10.0f : 0.0f);
-    outputs[MEL_8VA_OUTPUT].setVoltage(melVoltage + 1.0f);
-    lastGate = gate;
-    lastMelNote = melNote;
-
-    // TODO: move to ChordOut expander
-    int rootSub = rootBase + 36;
-    assert(rootSub >= 0);
-    outputs[ROOT_OUTPUT].setVoltage(midiToCV(rootSub));
+      simd::float_4 recomputedMask = (recomputed > 0.f);
+      simd::float_4 newVoltage1 = simd::ifelse(recomputedMask, midiToCV(out1Note), oldVoltage1);
+      simd::float_4 newVoltage2 = simd::ifelse(recomputedMask, midiToCV(out2Note), oldVoltage2);
+      simd::float_4 newVoltage3 = simd::ifelse(recomputedMask, midiToCV(out3Note), oldVoltage3);
+      outputs[OUT1_OUTPUT].setVoltageSimd(newVoltage1, c);
+      outputs[OUT2_OUTPUT].setVoltageSimd(newVoltage2, c);
+      outputs[OUT3_OUTPUT].setVoltageSimd(newVoltage3, c);
+
+      // ChordOut has the root as well, with the rest of the chord; this one stays for existing patches
+      outputs[ROOT_OUTPUT].setVoltageSimd(midiToCV(rootBase + 36.f), c);
+    }
+
+    if (message) {
+      if (++chordMessageSequence == 0) chordMessageSequence = 1;  // 0 means nothing received yet
+      message->sequence = chordMessageSequence;
+      message->channels = channels;
+      message->numVoices = voices;
+      rightExpander.module->leftExpander.requestMessageFlip();
+    }
+  }
+
+  // one channel of the expander message; the buffer alternates with the one Rack flipped away, so every
+  // channel is written every time, held notes included
+  void writeChordMessage(ChordMessage &message, int ch, int root, size_t chordTypeIndex, int note, int voices) {
+    if (root != sentRoot[ch] || (int) chordTypeIndex != sentChordTypeIndex[ch]) {
+      message.changed |= 1u << ch;
+      sentRoot[ch] = root;
+      sentChordTypeIndex[ch] = (int) chordTypeIndex;
+    }
+    message.root[ch] = (int8_t) root;
+    message.chordTypeIndex[ch] = (int16_t) chordTypeIndex;
+
+    const int* intervals = chords->chordIntervals(chordTypeIndex);
+    int numTones = std::min((int) chords->numIntervals(chordTypeIndex) + 1, MAX_CHORD_TONES);
+    message.numChordTones[ch] = (int8_t) numTones;
+    message.chordTones[ch][0] = 0;
+    for (int k = 1; k < numTones; k++) {
+      message.chordTones[ch][k] = (int8_t) intervals[k - 1];
+    }
+
+    message.melody[ch] = (int16_t) note;
+    for (int v = 0; v < voices; v++) {
+      message.offsets[ch][v] = (int8_t) (lastHarmonyNotes[ch][v] - note);
+    }
+  }
+
+  // reduces the chord cable to its pitch classes and looks the chord up when they change; notes that
+  // don't spell a chord keep the last one that did, and until then the knobs' chord
+  void updateRecognizedChord() {
+    int mask = 0;
+    int noteChannels = inputs[ROOT_INPUT].getChannels();
+    float quantizerHysteresis = hysteresis();
+    for (int c = 0; c < noteChannels; c += 4) {
+      simd::float_4 pitchClasses = pitchClass(rootQuantizer.process(inputs[ROOT_INPUT].getVoltageSimd<simd::float_4>(c), c, quantizerHysteresis));
+      for (int i = 0; i < 4 && c + i < noteChannels; i++) {
+        mask |= 1 << (int) pitchClasses[i];
+      }
+    }
+    if (mask == chordMask && recognizedChord.root >= 0)
+      return;
+    chordMask = mask;
+
+    const ChordMatch &match = chords->recognizeChord(mask);
+    if (match.root >= 0) {
+      recognizedChord = match;
+    } else if (recognizedChord.root < 0) {
+      recognizedChord.root = ((int) params[ROOT_PARAM].getValue()) % 12;
+      recognizedChord.chordTypeIndex = (int16_t) std::min((size_t) params[CHORD_PARAM].getValue(), chords->size() - 1);
+    }
+  }
+
+  // audio thread: the parts of a new snapshot that need more than reading
+  void applySettings() {
+    const Settings &active = settingsBuffer.read();
+    if (active.controlRateIndex != appliedControlRateIndex) {
+      appliedControlRateIndex = active.controlRateIndex;
+      controlDivider.setDivision(CONTROL_RATE_DIVISIONS[appliedControlRateIndex]);
+    }
+    if (active.reseedCount != appliedReseedCount) {
+      appliedReseedCount = active.reseedCount;
+      strategies.randomPassing.random.seed(active.randomSeed);
+    }
+    if (active.resetCount != appliedResetCount) {
+      appliedResetCount = active.resetCount;
+      diagnostics = Diagnostics();
+      windowSamples = 0;
+      windowTimed = 0;
+      windowTotal = 0.0;
+    }
+  }
+
+  // audio thread
+  void recordProcessTime(double micros) {
+    if (windowTimed == 0 || micros < windowMin) windowMin = micros;
+    if (windowTimed == 0 || micros > windowMax) windowMax = micros;
+    windowTotal += micros;
+    windowTimed++;
+  }
+
+  // audio thread: hands the counters and this window's timing to the UI, then starts the next window
+  void publishDiagnostics() {
+    diagnostics.timed = windowTimed > 0;
+    diagnostics.minMicros = diagnostics.timed ? windowMin : 0.f;
+    diagnostics.avgMicros = diagnostics.timed ? windowTotal / windowTimed : 0.f;
+    diagnostics.maxMicros = diagnostics.timed ? windowMax : 0.f;
+    diagnosticsBuffer.publish(diagnostics);
+    windowSamples = 0;
+    windowTimed = 0;
+    windowTotal = 0.0;
+  }
+
+  // UI thread: the counters as of the last window
+  const Diagnostics &readDiagnostics() {
+    diagnosticsBuffer.update();
+    return diagnosticsBuffer.read();
+  }
+
+  json_t* diagnosticsToJson() {
+    const Diagnostics &d = readDiagnostics();
+    json_t* rootJ = json_object();
+    json_object_set_new(rootJ, "id", json_integer(id));
+    json_object_set_new(rootJ, "samples", json_integer(d.samples));
+    json_object_set_new(rootJ, "harmonyPasses", json_integer(d.harmonyPasses));
+    json_object_set_new(rootJ, "skippedSamples", json_integer(d.samples - d.harmonyPasses));
+    json_object_set_new(rootJ, "recomputedNotes", json_integer(d.recomputedNotes));
+    json_t* passingJ = json_object();
+    for (size_t h = 0; h < HarmonyStrategies::NUM_HARMONIZERS; h++) {
+      json_object_set_new(passingJ, strategies.harmonizers[h]->displayName().c_str(), json_integer(d.passingTones[h]));
+    }
+    json_object_set_new(rootJ, "passingTones", passingJ);
+    if (d.timed) {
+      json_t* timeJ = json_object();
+      json_object_set_new(timeJ, "min", json_real(d.minMicros));
+      json_object_set_new(timeJ, "avg", json_real(d.avgMicros));
+      json_object_set_new(timeJ, "max", json_real(d.maxMicros));
+      json_object_set_new(rootJ, "processMicros", timeJ);
+    }
+    return rootJ;
+  }
+
+  // the setters below run on the UI thread and take effect at the audio thread's next process() call
+  void publishSettings() {
+    settingsBuffer.publish(settings);
+  }
+
+  void setControlRate(int index) {
+    settings.controlRateIndex = clamp(index, 0, NUM_CONTROL_RATES - 1);
+    publishSettings();
+  }
+
+  void setRandomSeed(uint32_t seed) {
+    settings.randomSeed = seed;
+    settings.reseedCount++;
+    publishSettings();
+  }
+
+  void setTriggerWidth(int index) {
+    settings.triggerWidthIndex = clamp(index, 0, NUM_TRIGGER_WIDTHS - 1);
+    publishSettings();
+  }
+
+  void setNumVoices(int voices) {
+    settings.numVoices = clamp(voices, MIN_VOICES, MAX_VOICES);
+    publishSettings();
+  }
+
+  void setChordRecognition(bool enabled) {
+    settings.chordRecognition = enabled;
+    publishSettings();
+  }
+
+  void setMeasureTime(bool enabled) {
+    settings.measureTime = enabled;
+    publishSettings();
+  }
+
+  void resetDiagnostics() {
+    settings.resetCount++;
+    publishSettings();
+  }
+
+  void onReset(const ResetEvent& e) override {
+    Module::onReset(e);
+    setControlRate(0);
+    setNumVoices(DEFAULT_VOICES);
+    setTriggerWidth(0);
+    setChordRecognition(false);
+    setHysteresisCents(DEFAULT_HYSTERESIS_CENTS);
+    // a fixed seed restarts its sequence, otherwise start a new one
+    setRandomSeed(fixedSeed ? settings.randomSeed : random::u32());
+  }
+
+  json_t* dataToJson() override {
+    json_t* rootJ = json_object();
+    json_object_set_new(rootJ, "controlRateDivision", json_integer(CONTROL_RATE_DIVISIONS[settings.controlRateIndex]));
+    json_object_set_new(rootJ, "voices", json_integer(settings.numVoices));
+    json_object_set_new(rootJ, "triggerWidthMs", json_real(TRIGGER_WIDTHS_MS[settings.triggerWidthIndex]));
+    json_object_set_new(rootJ, "chordRecognition", json_boolean(settings.chordRecognition));
+    hysteresisToJson(rootJ);
+    json_object_set_new(rootJ, "fixedSeed", json_boolean(fixedSeed));
+    if (fixedSeed) {
+      json_object_set_new(rootJ, "randomSeed", json_integer(settings.randomSeed));
+    }
+    return rootJ;
+  }
+
+  void dataFromJson(json_t* rootJ) override {
+    json_t* controlRateJ = json_object_get(rootJ, "controlRateDivision");
+    if (controlRateJ) {
+      int division = json_integer_value(controlRateJ);
+      for (int i = 0; i < NUM_CONTROL_RATES; i++) {
+        if (CONTROL_RATE_DIVISIONS[i] == division) setControlRate(i);
+      }
+    }
+
+    json_t* voicesJ = json_object_get(rootJ, "voices");
+    if (voicesJ) {
+      setNumVoices(json_integer_value(voicesJ));
+    }
+
+    json_t* triggerWidthJ = json_object_get(rootJ, "triggerWidthMs");
+    if (triggerWidthJ) {
+      float width = json_number_value(triggerWidthJ);
+      for (int i = 0; i < NUM_TRIGGER_WIDTHS; i++) {
+        if (TRIGGER_WIDTHS_MS[i] == width) setTriggerWidth(i);
+      }
+    }
+
+    json_t* chordRecognitionJ = json_object_get(rootJ, "chordRecognition");
+    if (chordRecognitionJ) {
+      setChordRecognition(json_boolean_value(chordRecognitionJ));
+    }
+
+    hysteresisFromJson(rootJ);
+
+    json_t* fixedSeedJ = json_object_get(rootJ, "fixedSeed");
+    if (fixedSeedJ) {
+      fixedSeed = json_boolean_value(fixedSeedJ);
+    }
+    json_t* randomSeedJ = json_object_get(rootJ, "randomSeed");
+    if (fixedSeed && randomSeedJ) {
+      setRandomSeed(json_integer_value(randomSeedJ));
+    }
+  }
+};
+
+struct SeedField : ui::TextField {
+	NestlingAudio_Jazz* module;
+
+	void onChange(const ChangeEvent& e) override {
+		module->fixedSeed = true;
+		module->setRandomSeed(std::strtoul(getText().c_str(), NULL, 10));
 	}
 };
 
+// a menu line that keeps itself up to date while the menu is open
+struct LiveMenuLabel : MenuLabel {
+	std::function<std::string()> getText;
+
+	void step() override {
+		text = getText();
+		MenuLabel::step();
+	}
+};
+
+static LiveMenuLabel* createLiveMenuLabel(std::function<std::string()> getText) {
+	LiveMenuLabel* label = new LiveMenuLabel;
+	label->getText = getText;
+	label->text = getText();
+	return label;
+}
+
+// every Jazz in the patch, so the expensive ones stand out
+static void copyAllDiagnostics() {
+	json_t* modulesJ = json_array();
+	for (int64_t moduleId : APP->engine->getModuleIds()) {
+		NestlingAudio_Jazz* module = dynamic_cast<NestlingAudio_Jazz*>(APP->engine->getModule(moduleId));
+		if (module) {
+			json_array_append_new(modulesJ, module->diagnosticsToJson());
+		}
+	}
+	char* text = json_dumps(modulesJ, JSON_INDENT(2));
+	glfwSetClipboardString(APP->window->win, text);
+	std::free(text);
+	json_decref(modulesJ);
+}
+
 struct JazzDisplay : LedDisplay {
 	NestlingAudio_Jazz* module;
 
-	void drawLayer(const DrawArgs& args, int layer) override {
-		if (layer == 1) {
-			std::string fontPath = "res/fonts/DIN-Alternate-Bold.ttf";
-			std::shared_ptr<Font> font = APP->window->loadFont(asset::plugin(pluginInstance, fontPath));
+	// the font is loaded once per graphics context, and the label is only rebuilt and measured when the
+	// chord changes
+	std::shared_ptr<Font> font;
+	std::shared_ptr<const ChordTable> labelChords;
+	int labelRoot = -1;
+	int labelChord = -1;
+	std::string label;
+	float labelWidth = 0.f;
+	float labelHeight = 0.f;
+	bool labelMeasured = false;
+
+	void onContextCreate(const ContextCreateEvent& e) override {
+		font = NULL;
+		labelMeasured = false;
+		LedDisplay::onContextCreate(e);
+	}
 
-			if (!font) {
-        INFO("No font!\n");
-				return;
-      }
+	void onContextDestroy(const ContextDestroyEvent& e) override {
+		font = NULL;
+		LedDisplay::onContextDestroy(e);
+	}
 
-			nvgSave(args.vg);
-			nvgFontFaceId(args.vg, font->handle);
-			nvgFontSize(args.vg, 13);
-			nvgTextLetterSpacing(args.vg, 0.0);
-			nvgTextAlign(args.vg, NVG_ALIGN_LEFT | NVG_ALIGN_TOP);
-			nvgFillColor(args.vg, nvgRGB(255, 255, 99));
-      if (module != NULL &&
-          module->getParamQuantity(NestlingAudio_Jazz::ROOT_PARAM) != NULL &&
-          module->getParamQuantity(NestlingAudio_Jazz::CHORD_PARAM) != NULL) {
-        std::string text = string::f("%s%s", 
-            module->getParamQuantity(NestlingAudio_Jazz::ROOT_PARAM)->getDisplayValueString().c_str(),
-            module->getParamQuantity(NestlingAudio_Jazz::CHORD_PARAM)->getDisplayValueString().c_str());
-        INFO("about to get bounds\n");
-        float bounds[4];
-        nvgTextBounds(args.vg, 0, 0, text.c_str(), NULL, bounds);
-        INFO("Bounds: %f, %f, %f, %f\n", bounds[0], bounds[1], bounds[2], bounds[3]);
-        float x = this->box.size.x;
-        float y = this->box.size.y;
-        nvgText(args.vg, (x - (bounds[2] - bounds[0]))/2, (y - (bounds[3] - bounds[1]))/2, text.c_str(), NULL);
-      }
-			nvgRestore(args.vg);
+	void updateLabel() {
+		int root = module->getEffectiveValue(NestlingAudio_Jazz::ROOT_PARAM);
+		int chordTypeIndex = module->getEffectiveValue(NestlingAudio_Jazz::CHORD_PARAM);
+		std::shared_ptr<const ChordTable> chords = module->chordsForUi();
+		if (root == labelRoot && chordTypeIndex == labelChord && chords == labelChords)
+			return;
+		labelRoot = root;
+		labelChord = chordTypeIndex;
+		labelChords = chords;
+		label.clear();
+		if (chords && chordTypeIndex >= 0 && (size_t) chordTypeIndex < chords->size()) {
+			label = module->midiToString(root) + chords->names[chordTypeIndex];
+		}
+		labelMeasured = false;
+	}
+
+	void drawLayer(const DrawArgs& args, int layer) override {
+		if (layer == 1 && module != NULL) {
+			if (!font) {
+				font = APP->window->loadFont(asset::plugin(pluginInstance, "res/fonts/DIN-Alternate-Bold.ttf"));
+			}
+			updateLabel();
+			if (font && !label.empty()) {
+				nvgSave(args.vg);
+				nvgFontFaceId(args.vg, font->handle);
+				nvgFontSize(args.vg, 13);
+				nvgTextLetterSpacing(args.vg, 0.0);
+				nvgTextAlign(args.vg, NVG_ALIGN_LEFT | NVG_ALIGN_TOP);
+				nvgFillColor(args.vg, nvgRGB(255, 255, 99));
+				if (!labelMeasured) {
+					float bounds[4];
+					nvgTextBounds(args.vg, 0, 0, label.c_str(), NULL, bounds);
+					labelWidth = bounds[2] - bounds[0];
+					labelHeight = bounds[3] - bounds[1];
+					labelMeasured = true;
+				}
+				nvgText(args.vg, (box.size.x - labelWidth) / 2, (box.size.y - labelHeight) / 2, label.c_str(), NULL);
+				nvgRestore(args.vg);
+			}
 		}
 		LedDisplay::drawLayer(args, layer);
 	}
 };
 
 struct NestlingAudio_JazzWidget : ModuleWidget {
+	std::shared_ptr<const ChordTable> knobChords;  // the table the chord knob's range and labels come from
+
 	NestlingAudio_JazzWidget(NestlingAudio_Jazz* module) {
 		setModule(module);
 		setPanel(createPanel(asset::plugin(pluginInstance, "res/NestlingAudio-Jazz.svg")));
@@ -383,7 +797,136 @@ struct NestlingAudio_JazzWidget : ModuleWidget {
 		addOutput(createOutputCentered<PJ301MPort>(mm2px(Vec(13.491, 112.692)), module, NestlingAudio_Jazz::ROOT_OUTPUT));
 		addOutput(createOutputCentered<PJ301MPort>(mm2px(Vec(30.48, 112.692)), module, NestlingAudio_Jazz::TRIG_OUTPUT));
 		addOutput(createOutputCentered<PJ301MPort>(mm2px(Vec(47.326, 112.692)), module, NestlingAudio_Jazz::MEL_8VA_OUTPUT));
+		addOutput(createOutputCentered<PJ301MPort>(mm2px(Vec(49.833, 71.048)), module, NestlingAudio_Jazz::POLY_OUTPUT));
+		addOutput(createOutputCentered<PJ301MPort>(mm2px(Vec(49.833, 83.966)), module, NestlingAudio_Jazz::VOICE_TRIG_OUTPUT));
+
+	}
 
+	void step() override {
+		NestlingAudio_Jazz* module = getModule<NestlingAudio_Jazz>();
+		if (module) {
+			updateChordKnob(module);
+			// knobs follow their CV at frame rate rather than being driven from the audio thread
+			followEffectiveValue(module, NestlingAudio_Jazz::ROOT_PARAM, NestlingAudio_Jazz::ROOT_INPUT);
+			followEffectiveValue(module, NestlingAudio_Jazz::CHORD_PARAM,
+				module->settings.chordRecognition ? NestlingAudio_Jazz::ROOT_INPUT : NestlingAudio_Jazz::CHORD_INPUT);
+			followEffectiveValue(module, NestlingAudio_Jazz::HARMONY_PARAM, NestlingAudio_Jazz::HARMONY_INPUT);
+			followEffectiveValue(module, NestlingAudio_Jazz::VOICING_PARAM, NestlingAudio_Jazz::VOICING_INPUT);
+		}
+		ModuleWidget::step();
+	}
+
+	// after a reload the chord knob takes on the new table's size and names
+	void updateChordKnob(NestlingAudio_Jazz* module) {
+		std::shared_ptr<const ChordTable> chords = module->chordsForUi();
+		if (!chords || chords == knobChords)
+			return;
+		knobChords = chords;
+		LabelQuantity* pq = (LabelQuantity*) module->getParamQuantity(NestlingAudio_Jazz::CHORD_PARAM);
+		pq->maxValue = (float) (chords->size() - 1);
+		pq->setLabels(chords->names);
+		if (pq->getValue() > pq->maxValue) {
+			pq->setValue(pq->maxValue);
+		}
+	}
+
+	void followEffectiveValue(NestlingAudio_Jazz* module, int paramId, int inputId) {
+		if (!module->inputs[inputId].isConnected())
+			return;
+		ParamQuantity* pq = module->getParamQuantity(paramId);
+		int value = module->getEffectiveValue(paramId);
+		if (pq != NULL && (int) pq->getValue() != value) {
+			pq->setValue(value);
+		}
+	}
+
+	void appendContextMenu(Menu* menu) override {
+		NestlingAudio_Jazz* module = getModule<NestlingAudio_Jazz>();
+		if (!module)
+			return;
+
+		menu->addChild(new MenuSeparator);
+		std::vector<std::string> rateLabels;
+		for (int i = 0; i < NUM_CONTROL_RATES; i++) {
+			int division = CONTROL_RATE_DIVISIONS[i];
+			rateLabels.push_back(division == 1 ? "Every sample" : string::f("Every %d samples", division));
+		}
+		menu->addChild(createIndexSubmenuItem("Harmony update rate", rateLabels,
+			[=]() {return module->settings.controlRateIndex;},
+			[=](int index) {module->setControlRate(index);}
+		));
+
+		std::vector<std::string> widthLabels;
+		for (int i = 0; i < NUM_TRIGGER_WIDTHS; i++) {
+			widthLabels.push_back(string::f("%g ms", TRIGGER_WIDTHS_MS[i]));
+		}
+		menu->addChild(createIndexSubmenuItem("Trigger length", widthLabels,
+			[=]() {return module->settings.triggerWidthIndex;},
+			[=](int index) {module->setTriggerWidth(index);}
+		));
+
+		module->appendHysteresisMenu(menu);
+		module->appendReloadChordsMenu(menu);
+
+		menu->addChild(createBoolMenuItem("Recognize chord from notes on root input", "",
+			[=]() {return module->settings.chordRecognition;},
+			[=](bool enabled) {module->setChordRecognition(enabled);}
+		));
+
+		std::vector<std::string> voiceLabels;
+		for (int voices = MIN_VOICES; voices <= MAX_VOICES; voices++) {
+			voiceLabels.push_back(string::f("%d", voices));
+		}
+		menu->addChild(createIndexSubmenuItem("Harmony voices", voiceLabels,
+			[=]() {return module->settings.numVoices - MIN_VOICES;},
+			[=](int index) {module->setNumVoices(MIN_VOICES + index);}
+		));
+
+		menu->addChild(createSubmenuItem("Random passing seed", "", [=](Menu* menu) {
+			menu->addChild(createBoolPtrMenuItem("Fixed seed (repeatable)", "", &module->fixedSeed));
+			SeedField* seedField = new SeedField;
+			seedField->module = module;
+			seedField->box.size.x = 120;
+			seedField->text = string::f("%u", module->settings.randomSeed);
+			menu->addChild(seedField);
+			menu->addChild(createMenuItem("Restart sequence", "", [=]() {module->setRandomSeed(module->settings.randomSeed);}));
+			menu->addChild(createMenuItem("New seed", "", [=]() {module->setRandomSeed(random::u32());}));
+		}));
+
+		menu->addChild(createSubmenuItem("Diagnostics", "", [=](Menu* menu) {
+			menu->addChild(createLiveMenuLabel([=]() {
+				const NestlingAudio_Jazz::Diagnostics &d = module->readDiagnostics();
+				return string::f("Harmony ran on %llu of %llu samples", (unsigned long long) d.harmonyPasses, (unsigned long long) d.samples);
+			}));
+			menu->addChild(createLiveMenuLabel([=]() {
+				return string::f("%llu notes harmonized", (unsigned long long) module->readDiagnostics().recomputedNotes);
+			}));
+			for (size_t h = 0; h < HarmonyStrategies::NUM_HARMONIZERS; h++) {
+				std::string name = module->strategies.harmonizers[h]->displayName();
+				menu->addChild(createLiveMenuLabel([=]() {
+					return string::f("%s: %llu passing tones", name.c_str(), (unsigned long long) module->readDiagnostics().passingTones[h]);
+				}));
+			}
+			menu->addChild(createLiveMenuLabel([=]() {
+				const NestlingAudio_Jazz::Diagnostics &d = module->readDiagnostics();
+				if (!d.timed)
+					return std::string("Process time not measured");
+				return string::f("Process time %.2f / %.2f / %.2f µs (min/avg/max)", d.minMicros, d.avgMicros, d.maxMicros);
+			}));
+			menu->addChild(createBoolMenuItem("Measure process time", "",
+				[=]() {return module->settings.measureTime;},
+				[=](bool enabled) {module->setMeasureTime(enabled);}
+			));
+			menu->addChild(createMenuItem("Reset counters", "", [=]() {module->resetDiagnostics();}));
+			menu->addChild(createMenuItem("Copy as JSON", "", [=]() {
+				json_t* diagnosticsJ = module->diagnosticsToJson();
+				char* text = json_dumps(diagnosticsJ, JSON_INDENT(2));
+				glfwSetClipboardString(APP->window->win, text);
+				std::free(text);
+				json_decref(diagnosticsJ);
+			}));
+			menu->addChild(createMenuItem("Copy all Jazz modules as JSON", "", copyAllDiagnostics));
+		}));
 	}
 };
 
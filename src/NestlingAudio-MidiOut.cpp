@@ -0,0 +1,149 @@
+#include "plugin.hpp"
+#include "ChordMessage.hpp"
+
+
+// velocity of every note-on
+static const uint8_t NOTE_VELOCITY = 100;
+
+
+// Expander that plays Jazz's harmony voices on a MIDI port.  Each voice keeps its own MIDI channel, counting up
+// from the port's channel in the same order as Jazz's poly output (melody channel 1's voices first, up to 16),
+// so a voice always lands on the same synth.  Notes go out only when a voice's note changes: a note-off for the
+// old one and a note-on for the new one, all of a message's changes in the same process() call.
+struct NestlingAudio_MidiOut : Module {
+	enum ParamId {
+		PARAMS_LEN
+	};
+	enum InputId {
+		INPUTS_LEN
+	};
+	enum OutputId {
+		OUTPUTS_LEN
+	};
+	enum LightId {
+		LIGHTS_LEN
+	};
+
+  // Rack flips these between the module on the left writing one and this module reading the other
+  ChordMessage messages[2] = {};
+  uint32_t lastSequence = 0;
+
+  midi::Output midiOutput;
+  // the note sounding on each voice's channel, -1 for none, and the channel it went out on, so its note-off
+  // follows it even if the port's channel has been changed since
+  int heldNotes[PORT_MAX_CHANNELS];
+  int heldChannels[PORT_MAX_CHANNELS];
+
+	NestlingAudio_MidiOut() {
+		config(PARAMS_LEN, INPUTS_LEN, OUTPUTS_LEN, LIGHTS_LEN);
+
+    leftExpander.producerMessage = &messages[0];
+    leftExpander.consumerMessage = &messages[1];
+    std::fill(heldNotes, heldNotes + PORT_MAX_CHANNELS, -1);
+    std::fill(heldChannels, heldChannels + PORT_MAX_CHANNELS, 0);
+	}
+
+	void process(const ProcessArgs& args) override {
+    const ChordMessage* message = receiveChordMessage(this);
+    if (message) {
+      if (message->sequence != lastSequence) {
+        lastSequence = message->sequence;
+        sendChanges(*message, args.frame);
+        forwardChordMessage(this, *message);
+      }
+    } else if (lastSequence != 0) {
+      // unplugged from the chain: nothing would ever turn the notes off
+      lastSequence = 0;
+      allNotesOff(args.frame);
+    }
+	}
+
+  void sendChanges(const ChordMessage &message, int64_t frame) {
+    int channels = std::max(0, std::min((int) message.channels, PORT_MAX_CHANNELS));
+    int voices = std::max(1, std::min((int) message.numVoices, MAX_VOICES));
+    int firstChannel = std::max(0, midiOutput.getChannel());
+    for (int slot = 0; slot < PORT_MAX_CHANNELS; slot++) {
+      int ch = slot / voices;
+      int note = -1;
+      if (ch < channels) {
+        note = message.melody[ch] + message.offsets[ch][slot % voices];
+        if (note < 0 || note > 127) note = -1;
+      }
+      int midiChannel = (firstChannel + slot) % 16;
+      if (note == heldNotes[slot] && midiChannel == heldChannels[slot])
+        continue;
+
+      if (heldNotes[slot] >= 0) sendNote(0x8, heldChannels[slot], heldNotes[slot], 0, frame);
+      if (note >= 0) sendNote(0x9, midiChannel, note, NOTE_VELOCITY, frame);
+      heldNotes[slot] = note;
+      heldChannels[slot] = midiChannel;
+    }
+  }
+
+  void allNotesOff(int64_t frame) {
+    for (int slot = 0; slot < PORT_MAX_CHANNELS; slot++) {
+      if (heldNotes[slot] >= 0) sendNote(0x8, heldChannels[slot], heldNotes[slot], 0, frame);
+      heldNotes[slot] = -1;
+    }
+  }
+
+  // straight to the device: midi::Output::sendMessage would move every voice onto the port's one channel
+  void sendNote(uint8_t status, int channel, int note, uint8_t velocity, int64_t frame) {
+    midi::OutputDevice* device = midiOutput.outputDevice;
+    if (!device)
+      return;
+    midi::Message message;
+    message.setStatus(status);
+    message.setChannel((uint8_t) channel);
+    message.setNote((uint8_t) note);
+    message.setValue(velocity);
+    message.setFrame(frame);
+    device->sendMessage(message);
+  }
+
+  void onReset(const ResetEvent& e) override {
+    allNotesOff(-1);
+    lastSequence = 0;
+    midiOutput.reset();
+    Module::onReset(e);
+  }
+
+  void onRemove(const RemoveEvent& e) override {
+    allNotesOff(-1);
+    Module::onRemove(e);
+  }
+
+  json_t* dataToJson() override {
+    json_t* rootJ = json_object();
+    json_object_set_new(rootJ, "midi", midiOutput.toJson());
+    return rootJ;
+  }
+
+  void dataFromJson(json_t* rootJ) override {
+    json_t* midiJ = json_object_get(rootJ, "midi");
+    if (midiJ) {
+      midiOutput.fromJson(midiJ);
+    }
+  }
+};
+
+
+struct NestlingAudio_MidiOutWidget : ModuleWidget {
+	NestlingAudio_MidiOutWidget(NestlingAudio_MidiOut* module) {
+		setModule(module);
+		setPanel(createPanel(asset::plugin(pluginInstance, "res/NestlingAudio-MidiOut.svg")));
+
+		addChild(createWidget<ScrewSilver>(Vec(RACK_GRID_WIDTH, 0)));
+		addChild(createWidget<ScrewSilver>(Vec(box.size.x - 2 * RACK_GRID_WIDTH, 0)));
+		addChild(createWidget<ScrewSilver>(Vec(RACK_GRID_WIDTH, RACK_GRID_HEIGHT - RACK_GRID_WIDTH)));
+		addChild(createWidget<ScrewSilver>(Vec(box.size.x - 2 * RACK_GRID_WIDTH, RACK_GRID_HEIGHT - RACK_GRID_WIDTH)));
+
+		MidiDisplay* display = createWidget<MidiDisplay>(mm2px(Vec(3.41891, 14.8373)));
+		display->box.size = mm2px(Vec(33.840, 28.0));
+		display->setMidiPort(module ? &module->midiOutput : NULL);
+		addChild(display);
+	}
+};
+
+
+Model* modelNestlingAudio_MidiOut = createModel<NestlingAudio_MidiOut, NestlingAudio_MidiOutWidget>("NestlingAudio-MidiOut");
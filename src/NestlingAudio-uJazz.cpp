@@ -1,5 +1,6 @@
 #include "plugin.hpp"
 #include "NestlingAudio.hpp"
+#include "SnapshotBuffer.hpp"
 
 
 struct NestlingAudio_uJazz : NestlingAudio {
@@ -22,7 +23,22 @@ struct NestlingAudio_uJazz : NestlingAudio {
 		LIGHTS_LEN
 	};
 
-  Harmonizer* harmonizer;
+  BasicHarmonizer harmonizer;
+  HarmonyState harmonyStates[PORT_MAX_CHANNELS];
+
+  // last quantized inputs, four channels per entry, so unchanged inputs skip the harmonizer entirely
+  simd::float_4 lastRootBase[PORT_MAX_CHANNELS / 4];
+  simd::float_4 lastChordTypeIndex[PORT_MAX_CHANNELS / 4];
+  simd::float_4 lastMelNote[PORT_MAX_CHANNELS / 4];
+  int lastChannels = 0;
+
+  // channel 0's inputs and harmony for the port tooltips: published by the audio thread when they change, and
+  // picked up by the widget at UI rate
+  struct Description {
+    int values[6];  // root, chord type index, melody note, then the three harmony notes
+  };
+  SnapshotBuffer<Description> descriptions {Description {{0, 0, 0, 0, 0, 0}}};
+  int displayed[6] = {-1, -1, -1, -1, -1, -1};  // UI thread only
 
 	NestlingAudio_uJazz() {
 		config(PARAMS_LEN, INPUTS_LEN, OUTPUTS_LEN, LIGHTS_LEN);
@@ -34,34 +50,103 @@ struct NestlingAudio_uJazz : NestlingAudio {
 		configOutput(OUT3_OUTPUT, "harmony note 3, 1v/oct");
 
     loadChords();
-		harmonizer = new BasicHarmonizer();
-    harmonizer->init(chordIntervals);
+    harmonizer.init(chords);
+
+    for (int g = 0; g < PORT_MAX_CHANNELS / 4; g++) {
+      lastRootBase[g] = 0.f;
+      lastChordTypeIndex[g] = 0.f;
+      lastMelNote[g] = 0.f;
+    }
 	}
 
 	void process(const ProcessArgs& args) override {
-    // INPUT
-    float rootVoltage = inputs[ROOT_INPUT].getVoltage();
-    int rootBase = cvToMidi(rootVoltage) % 12;
-    getInputInfo(ROOT_INPUT)->description = midiToString(rootBase);
-
-  	size_t chordTypeIndex = cvToIndex(inputs[CHORD_INPUT].getVoltage(), chordNames.size());
-    getInputInfo(CHORD_INPUT)->description = chordNames[chordTypeIndex];
-
-    float melVoltage = inputs[MEL_INPUT].getVoltage();
-    int melNote = cvToMidi(melVoltage);
-    getInputInfo(MEL_INPUT)->description = midiToString(melNote);
-
-		// ALGORITHM
-    int offsets[3];
-    harmonizer->computeOffsets(chordTypeIndex, melNote, rootBase, offsets);
-
-    outputs[OUT1_OUTPUT].setVoltage(midiToCV(melNote + offsets[0]));
-    outputs[OUT2_OUTPUT].setVoltage(midiToCV(melNote + offsets[1]));
-    outputs[OUT3_OUTPUT].setVoltage(midiToCV(melNote + offsets[2]));
-    getOutputInfo(OUT1_OUTPUT)->description = midiToString(melNote + offsets[0]);
-    getOutputInfo(OUT2_OUTPUT)->description = midiToString(melNote + offsets[1]);
-    getOutputInfo(OUT3_OUTPUT)->description = midiToString(melNote + offsets[2]);
+    if (updateChords()) {
+      harmonizer.init(chords);
+      lastChannels = 0;  // harmonize every channel again from the reloaded table
+    }
+
+    // one set of outputs per melody channel; root and chord may be mono or follow the melody channels
+    int channels = std::max(1, inputs[MEL_INPUT].getChannels());
+    float quantizerHysteresis = hysteresis();
+
+    for (int c = 0; c < channels; c += 4) {
+      // INPUT
+      simd::float_4 rootBase = pitchClass(rootQuantizer.process(inputs[ROOT_INPUT].getPolyVoltageSimd<simd::float_4>(c), c, quantizerHysteresis));
+      simd::float_4 chordTypeIndex = cvToIndex(inputs[CHORD_INPUT].getPolyVoltageSimd<simd::float_4>(c), chords->size());
+      simd::float_4 melNote = melQuantizer.process(inputs[MEL_INPUT].getVoltageSimd<simd::float_4>(c), c, quantizerHysteresis);
+
+      // nothing to do unless one of this group's channels quantized to something new
+      int group = c / 4;
+      int changed = simd::movemask((rootBase != lastRootBase[group]) |
+                                   (chordTypeIndex != lastChordTypeIndex[group]) |
+                                   (melNote != lastMelNote[group]));
+      if (channels - c < 4) changed &= (1 << (channels - c)) - 1;
+      if (changed == 0 && channels == lastChannels) continue;
+      lastRootBase[group] = rootBase;
+      lastChordTypeIndex[group] = chordTypeIndex;
+      lastMelNote[group] = melNote;
+
+      // ALGORITHM
+      simd::float_4 offset1 = 0.f;
+      simd::float_4 offset2 = 0.f;
+      simd::float_4 offset3 = 0.f;
+      for (int i = 0; i < 4 && c + i < channels; i++) {
+        int offsets[MAX_VOICES];
+        harmonizer.computeOffsets((size_t) chordTypeIndex[i], (int) melNote[i], (int) rootBase[i], 3, harmonyStates[c + i], offsets);
+        offset1[i] = offsets[0];
+        offset2[i] = offsets[1];
+        offset3[i] = offsets[2];
+      }
+
+      outputs[OUT1_OUTPUT].setVoltageSimd(midiToCV(melNote + offset1), c);
+      outputs[OUT2_OUTPUT].setVoltageSimd(midiToCV(melNote + offset2), c);
+      outputs[OUT3_OUTPUT].setVoltageSimd(midiToCV(melNote + offset3), c);
+
+      if (c == 0) {
+        int melNote0 = (int) melNote[0];
+        descriptions.publish(Description {{(int) rootBase[0], (int) chordTypeIndex[0], melNote0,
+            melNote0 + (int) offset1[0], melNote0 + (int) offset2[0], melNote0 + (int) offset3[0]}});
+      }
+    }
+    lastChannels = channels;
+    outputs[OUT1_OUTPUT].setChannels(channels);
+    outputs[OUT2_OUTPUT].setChannels(channels);
+    outputs[OUT3_OUTPUT].setChannels(channels);
 	}
+
+  void onReset(const ResetEvent& e) override {
+    Module::onReset(e);
+    setHysteresisCents(DEFAULT_HYSTERESIS_CENTS);
+  }
+
+  json_t* dataToJson() override {
+    json_t* rootJ = json_object();
+    hysteresisToJson(rootJ);
+    return rootJ;
+  }
+
+  void dataFromJson(json_t* rootJ) override {
+    hysteresisFromJson(rootJ);
+  }
+
+  // called from the UI thread; only touches the tooltip strings when channel 0's harmony has changed
+  void updateDescriptions() {
+    descriptions.update();
+    const int* current = descriptions.read().values;
+    size_t chordTypeIndex = (size_t) current[1];
+    std::shared_ptr<const ChordTable> chords = chordsForUi();
+    if (!chords || chordTypeIndex >= chords->size()) return;
+
+    if (std::equal(current, current + 6, displayed)) return;
+    std::copy(current, current + 6, displayed);
+
+    getInputInfo(ROOT_INPUT)->description = midiToString(current[0]);
+    getInputInfo(CHORD_INPUT)->description = chords->names[chordTypeIndex];
+    getInputInfo(MEL_INPUT)->description = midiToString(current[2]);
+    getOutputInfo(OUT1_OUTPUT)->description = midiToString(current[3]);
+    getOutputInfo(OUT2_OUTPUT)->description = midiToString(current[4]);
+    getOutputInfo(OUT3_OUTPUT)->description = midiToString(current[5]);
+  }
 };
 
 
@@ -83,6 +168,24 @@ struct NestlingAudio_uJazzWidget : ModuleWidget {
 		addOutput(createOutputCentered<PJ301MPort>(mm2px(Vec(13.491, 108.536)), module, NestlingAudio_uJazz::OUT2_OUTPUT));
 		addOutput(createOutputCentered<PJ301MPort>(mm2px(Vec(13.491, 116.714)), module, NestlingAudio_uJazz::OUT3_OUTPUT));
 	}
+
+	void step() override {
+		NestlingAudio_uJazz* module = getModule<NestlingAudio_uJazz>();
+		if (module) {
+			module->updateDescriptions();
+		}
+		ModuleWidget::step();
+	}
+
+	void appendContextMenu(Menu* menu) override {
+		NestlingAudio_uJazz* module = getModule<NestlingAudio_uJazz>();
+		if (!module)
+			return;
+
+		menu->addChild(new MenuSeparator);
+		module->appendHysteresisMenu(menu);
+		module->appendReloadChordsMenu(menu);
+	}
 };
 
 
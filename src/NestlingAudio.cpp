@@ -1,179 +1,274 @@
 #include "plugin.hpp"
 #include "NestlingAudio.hpp"
+#include <sys/stat.h>
+#include <algorithm>
 #include <cmath>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
 
 
-void Harmonizer::init(std::vector<std::vector<int>> &chordIntervals) {
-  this->chordIntervals = chordIntervals;
-}
+// Every module instance shares one table, read from disk when the first instance needs it and freed along
+// with the last one.  While any instance exists a worker thread polls the file's modification time once a
+// second and reads it again when it changes, as does "Reload chords" in a module's menu; either way the new
+// table is published through an atomic pointer.  The audio thread only ever loads that pointer; a replaced table is
+// kept until every module has reported moving past it.
+struct ChordLibrary {
+  std::mutex mutex;  // guards everything but the two atomics; never taken on the audio thread
+  std::vector<NestlingAudio*> modules;
+  std::shared_ptr<const ChordTable> current;
+  std::atomic<const ChordTable*> table {NULL};
+  std::atomic<uint32_t> generation {0};
+  std::vector<std::pair<uint32_t, std::shared_ptr<const ChordTable>>> retired;
+  // the file last read and its modification time, so the watcher only reads it again after a save
+  std::string loadedPath;
+  long long loadedTime = -1;
+  std::thread watcher;
+  std::condition_variable wake;
+  uint32_t watchRun = 0;  // bumped to stop the running watcher; a new one may start before the old one exits
 
-void BasicHarmonizer::_setPassingNoteOffsets(size_t chordTypeIndex, int melody, int root, int* offsets) {
-    // note not in chord --> use fully diminished chord as harmony
-    offsets[0] = -3;
-    offsets[1] = -6;
-    offsets[2] = -9;
-}
+  static long long modifiedTime(const std::string &path) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0)
+      return -1;
+    return (long long) info.st_mtime;
+  }
 
-void BasicHarmonizer::computeOffsets(size_t chordTypeIndex, int melody, int root, int* offsets) {
-  // todo: what's the right way to do this that avoids too much copying?
-  std::vector<int> *currentInts = &(chordIntervals[chordTypeIndex]);
-  int relativeMelNote = (melody - root) % 12;
-  const size_t numInts = currentInts->size();
-  if (relativeMelNote == 0) {
-    // harmony tones are top three non-root notes of chord
-    // TODO: fix bug where this won't include root if it should (if there are more voices than chord notes)
-    offsets[0] = (*currentInts)[(numInts-1) % numInts] - 12;
-    offsets[1] = (*currentInts)[(numInts-2) % numInts] - 12;
-    offsets[2] = (*currentInts)[(numInts-3) % numInts] - 12;
-  } else {
-    // find index of relativeMelNote in currentInts
-    int idx = -1;
-    for (size_t m = 0; m < numInts; m++) {
-      if ((*currentInts)[m] == relativeMelNote) {
-        idx = m;
-        break;
-      }
+  // the precompiled table wins unless the JSON has been edited since it was built
+  static std::string chordsPath() {
+    std::string jsonPath = asset::plugin(pluginInstance, "res/chords.json");
+    std::string binPath = asset::plugin(pluginInstance, "res/chords.bin");
+    long long binTime = modifiedTime(binPath);
+    return binTime >= 0 && binTime >= modifiedTime(jsonPath) ? binPath : jsonPath;
+  }
+
+  // called with the lock held; the release on generation makes the table visible to anyone who sees the new number
+  void publish(std::shared_ptr<const ChordTable> loaded) {
+    if (current) retired.push_back(std::make_pair(generation.load(std::memory_order_relaxed), current));
+    current = loaded;
+    table.store(current.get(), std::memory_order_release);
+    generation.fetch_add(1, std::memory_order_release);
+  }
+
+  // called with the lock held
+  void reclaim() {
+    uint32_t oldest = generation.load(std::memory_order_relaxed);
+    for (NestlingAudio* module : modules) {
+      oldest = std::min(oldest, module->seenChordsGeneration.load(std::memory_order_acquire));
+    }
+    retired.erase(std::remove_if(retired.begin(), retired.end(),
+      [=](const std::pair<uint32_t, std::shared_ptr<const ChordTable>> &entry) {return entry.first < oldest;}),
+      retired.end());
+  }
+
+  // UI or watcher thread; a file that doesn't load leaves the current table in place
+  bool reload() {
+    std::string path = chordsPath();
+    long long time = modifiedTime(path);
+    std::shared_ptr<const ChordTable> loaded;
+    // parse without the lock so other modules' UI never waits on a big file
+    try {
+      loaded = NestlingAudio::readChordTable(path);
+      if (loaded->size() == 0)
+        throw Exception("Chords file has no chords");
+    }
+    catch (Exception& e) {
+      WARN("Keeping the current chords: %s", e.what());
     }
-    if (idx == -1) {
-      this->_setPassingNoteOffsets(chordTypeIndex, melody, root, offsets);
-    } else {
-      size_t poSize = numInts + 1;
-      int possibleOffsets[poSize];
-      possibleOffsets[0] = 0 - relativeMelNote;
-      for (size_t i = 0; i < numInts; i++) {
-        possibleOffsets[i+1] = (*currentInts)[i] - relativeMelNote;
+    std::lock_guard<std::mutex> lock(mutex);
+    // remembered even when the file doesn't load, so the watcher waits for the next save rather than retrying
+    loadedPath = path;
+    loadedTime = time;
+    if (!loaded)
+      return false;
+    if (modules.empty())
+      return false;
+    reclaim();
+    publish(loaded);
+    INFO("Reloaded %d chords.", (int) loaded->size());
+    return true;
+  }
+
+  // polls rather than using the OS's change notifications, which differ on every platform Rack runs on
+  void watch(uint32_t run) {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      wake.wait_for(lock, std::chrono::seconds(1), [&]() {return watchRun != run;});
+      if (watchRun != run)
+        return;
+      std::string path = loadedPath;
+      long long time = loadedTime;
+      lock.unlock();
+      std::string newPath = chordsPath();
+      if (newPath != path || modifiedTime(newPath) != time)
+        reload();
+      lock.lock();
+    }
+  }
+
+  void attach(NestlingAudio* module) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!current) {
+      loadedPath = chordsPath();
+      loadedTime = modifiedTime(loadedPath);
+      // a bad file here still throws, since the module has nothing to fall back on
+      publish(NestlingAudio::readChordTable(loadedPath));
+      watcher = std::thread(&ChordLibrary::watch, this, ++watchRun);
+    }
+    module->chordsGeneration = generation.load(std::memory_order_relaxed);
+    module->chords = table.load(std::memory_order_relaxed);
+    module->seenChordsGeneration.store(module->chordsGeneration, std::memory_order_release);
+    modules.push_back(module);
+  }
+
+  void detach(NestlingAudio* module) {
+    std::thread stopped;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      std::vector<NestlingAudio*>::iterator it = std::find(modules.begin(), modules.end(), module);
+      if (it == modules.end())
+        return;
+      modules.erase(it);
+      if (!modules.empty()) {
+        reclaim();
+        return;
       }
-      int j = idx;
-      offsets[0] = (possibleOffsets[j] % 12);
-      if (offsets[0] >= 0) offsets[0] -= 12;
-      j--;
-      j = (j + poSize) % poSize;
-      offsets[1] = (possibleOffsets[j] % 12);
-      if (offsets[1] >= 0) offsets[1] -= 12;
-      j--;
-      j = (j + poSize) % poSize;
-      offsets[2] = (possibleOffsets[j] % 12);
-      if (offsets[2] >= 0) offsets[2] -= 12;
+      current = NULL;
+      table.store(NULL, std::memory_order_relaxed);
+      retired.clear();
+      watchRun++;
+      stopped = std::move(watcher);
     }
+    // joined without the lock, which the watcher needs in order to see that it should stop
+    wake.notify_all();
+    if (stopped.joinable())
+      stopped.join();
   }
-}
-std::string BasicHarmonizer::displayName() {
-  return "Diminished Passing";
-}
+};
 
-void CloseVoicer::adjustOffsets(int* offsets) {
-  // do nothing because the harmonizers already output close voicing
-}
-std::string CloseVoicer::displayName() {
-  return "Close";
+static ChordLibrary library;
+
+
+NestlingAudio::NestlingAudio() {
 }
 
-void DropTwoVoicer::adjustOffsets(int* offsets) {
-  int voiceTwo = offsets[0];
-  offsets[0] = offsets[1];
-  offsets[1] = offsets[2];
-  offsets[2] = voiceTwo - 12;
+NestlingAudio::~NestlingAudio() {
+  library.detach(this);
 }
-std::string DropTwoVoicer::displayName() {
-  return "Drop 2";
+
+void NestlingAudio::loadChords() {
+  library.attach(this);
 }
 
-void DropTwoFourVoicer::adjustOffsets(int* offsets) {
-  int voiceTwo = offsets[0];
-  int voiceFour = offsets[2];
-  offsets[0] = offsets[1];
-  offsets[1] = voiceTwo - 12;
-  offsets[2] = voiceFour - 12;
+bool NestlingAudio::updateChords() {
+  uint32_t generation = library.generation.load(std::memory_order_acquire);
+  if (generation == chordsGeneration)
+    return false;
+  // the table may be newer than the generation read above, never older, so the library keeps it alive
+  chords = library.table.load(std::memory_order_acquire);
+  chordsGeneration = generation;
+  seenChordsGeneration.store(generation, std::memory_order_release);
+  return true;
 }
-std::string DropTwoFourVoicer::displayName() {
-  return "Drop 2+4";
+
+bool NestlingAudio::reloadChords() {
+  return library.reload();
 }
 
+void NestlingAudio::appendReloadChordsMenu(Menu* menu) {
+  menu->addChild(createMenuItem("Reload chords", "", []() {reloadChords();}));
+}
 
-NestlingAudio::NestlingAudio() {
+std::shared_ptr<const ChordTable> NestlingAudio::chordsForUi() const {
+  std::lock_guard<std::mutex> lock(library.mutex);
+  return library.current;
 }
 
-void NestlingAudio::loadChords() {
+// reads either format, telling them apart by the binary's magic number
+std::shared_ptr<const ChordTable> NestlingAudio::readChordTable(const std::string &path) {
   INFO("Loading chords.");
-  FILE* file = std::fopen(asset::plugin(pluginInstance, "res/chords.json").c_str(), "r");
+  std::shared_ptr<ChordTable> table = std::make_shared<ChordTable>();
+  FILE* file = std::fopen(path.c_str(), "rb");
   if (!file)
-    return;
+    return table;
   DEFER({std::fclose(file);});
 
-  json_error_t error;
-  json_t* chordJ = json_loadf(file, 0, &error);
-  if (!chordJ)
-    throw Exception("Chords file has invalid JSON at %d:%d %s", error.line, error.column, error.text);
-
-  /*
-  char* js = json_dumps(chordJ, 0);
-  INFO("%s\n", js);
-  DEFER({free(js);});
-  */
-
-  assert(chordNames.size() == 0);
-  assert(chordIntervals.size() == 0);
-  size_t index;
-  json_t* value;
-  json_array_foreach(chordJ, index, value) {
-    json_t* jname = json_object_get(value, "name");
-    if (jname != NULL) {
-      const char* str = json_string_value(jname);
-      chordNames.push_back(str);
-    } else {
-      chordNames.push_back("error");
-    }
-    /*
-    char* chord = json_dumps(currentChordJ, 0);
-    INFO("Chord: %s\n", chord);
-    DEFER({free(chord);});
-    */
-    json_t* intervalsJson = json_object_get(value, "intervals");
-    if (intervalsJson != NULL) {
-      /*
-      char* intervals = json_dumps(intervalsJson, 0);
-      INFO("Intervals: %s\n", intervals);
-      */
-      const size_t numInts = json_array_size(intervalsJson);
-      std::vector<int> currentInts;
-      for (size_t i = 0; i < numInts; i++) {
-        json_t* intJ = json_array_get(intervalsJson, i);
-        int intv = 0;
-        if (intJ != NULL) {
-          json_unpack(intJ, "i", &intv);
-        }
-        currentInts.push_back(intv);
-      }
-      chordIntervals.push_back(currentInts);
-    }
+  std::string text;
+  char buffer[4096];
+  size_t count;
+  while ((count = std::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    text.append(buffer, count);
+  }
+
+  std::string error;
+  if (ChordTable::isBinary(text.data(), text.size())) {
+    if (!table->parseBinary(text.data(), text.size(), &error))
+      throw Exception("Chords file %s: %s", path.c_str(), error.c_str());
+    return table;
+  }
+  // the same reader as the tests and tools, so they check exactly what the plugin loads
+  int line, column;
+  if (!table->parseJson(text, &line, &column, &error))
+    throw Exception("Chords file has invalid JSON at %d:%d %s", line, column, error.c_str());
+  return table;
+}
+
+
+void NestlingAudio::setHysteresisCents(int cents) {
+  hysteresisCents.store(clamp(cents, 0, HYSTERESIS_CENTS[NUM_HYSTERESIS_CENTS - 1]), std::memory_order_relaxed);
+}
+
+void NestlingAudio::hysteresisToJson(json_t* rootJ) {
+  json_object_set_new(rootJ, "hysteresisCents", json_integer(hysteresisCents.load(std::memory_order_relaxed)));
+}
+
+// patches from before the setting existed get the default too; it only matters within a few cents of a boundary
+void NestlingAudio::hysteresisFromJson(json_t* rootJ) {
+  json_t* hysteresisJ = json_object_get(rootJ, "hysteresisCents");
+  if (hysteresisJ) {
+    setHysteresisCents(json_integer_value(hysteresisJ));
   }
 }
 
+void NestlingAudio::appendHysteresisMenu(Menu* menu) {
+  std::vector<std::string> labels;
+  for (int i = 0; i < NUM_HYSTERESIS_CENTS; i++) {
+    labels.push_back(HYSTERESIS_CENTS[i] == 0 ? "Off" : string::f("%d cents", HYSTERESIS_CENTS[i]));
+  }
+  menu->addChild(createIndexSubmenuItem("Pitch hysteresis", labels,
+    [=]() {
+      int cents = hysteresisCents.load(std::memory_order_relaxed);
+      size_t index = 0;
+      for (int i = 0; i < NUM_HYSTERESIS_CENTS; i++) {
+        if (HYSTERESIS_CENTS[i] <= cents) index = i;
+      }
+      return index;
+    },
+    [=](size_t index) {setHysteresisCents(HYSTERESIS_CENTS[index]);}
+  ));
+}
 
-int NestlingAudio::cvToMidi(const float voltage) {
-  return std::round(voltage * 12 + 60);
+simd::float_4 NestlingAudio::cvToMidi(const simd::float_4 voltage) {
+  return simd::round(voltage * 12.f + 60.f);
 }
 
-float NestlingAudio::midiToCV(const int midi) {
-  return (midi - 60) / 12.0f;
+simd::float_4 NestlingAudio::midiToCV(const simd::float_4 midi) {
+  return (midi - 60.f) / 12.f;
 }
 
-std::string NestlingAudio::midiToString(const int midi) {
-  std::string notes[] = {"C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B"};
-  return notes[midi % 12];
+simd::float_4 NestlingAudio::pitchClass(const simd::float_4 midi) {
+  return midi - 12.f * simd::floor(midi / 12.f);
 }
 
-size_t NestlingAudio::cvToIndex(const float voltage, const size_t length) {
-  size_t index = 0;
-  // TODO: consider making this a switch in the UI instead of a hardcoded constant
+simd::float_4 NestlingAudio::cvToIndex(const simd::float_4 voltage, const size_t length) {
+  simd::float_4 index;
   if (VOLTAGE_UNIPOLAR) {
-    index = (size_t) (voltage / 10.0f * length);
+    index = simd::floor(voltage / 10.f * length);
   } else {
-    index = (size_t) ((voltage + 5.0f) / 10.0f * length);
+    index = simd::floor((voltage + 5.f) / 10.f * length);
   }
-  if (index < 0) return 0;
-  if (index >= length) return length - 1;
-  return index;
+  return simd::clamp(index, 0.f, (float) (length - 1));
 }
 
 void NestlingAudio::process(const ProcessArgs& args) {
@@ -1,66 +1,90 @@
+#pragma once
 #include "plugin.hpp"
 #include <jansson.h>
-
-
-#define VOLTAGE_UNIPOLAR true
-
-
-// interface for the harmonizer strategy - module may switch between strategies
-struct Harmonizer {  // abstract
-  std::vector<std::vector<int>> chordIntervals;
-
-  virtual void init(std::vector<std::vector<int>> &chordIntervals);
-  virtual void computeOffsets(size_t chordTypeIndex, int melody, int root, int* offsets) = 0;
-  virtual void _setPassingNoteOffsets(size_t chordTypeIndex, int melody, int root, int* offsets) = 0;
-  virtual std::string displayName() = 0;
-};
-
-struct BasicHarmonizer : Harmonizer {
-  virtual void computeOffsets(size_t chordTypeIndex, int melody, int root, int* offsets) override;
-  virtual void _setPassingNoteOffsets(size_t chordTypeIndex, int melody, int root, int* offsets) override;
-  virtual std::string displayName() override;
+#include "Harmony.hpp"
+#include <atomic>
+
+
+// the hysteresis choices in the context menu, in cents
+static const int HYSTERESIS_CENTS[] = {0, 5, 10, 20, 30, 40};
+static const int NUM_HYSTERESIS_CENTS = 6;
+static const int DEFAULT_HYSTERESIS_CENTS = 10;
+
+// Rounds 1v/oct CV to MIDI note numbers, but a channel only leaves its note once the CV is `hysteresis`
+// semitones past the halfway point to the next one, so noise or vibrato near a boundary doesn't flip the
+// note back and forth.  Four channels per entry, like the inputs' SIMD reads.
+struct PitchQuantizer {
+  simd::float_4 notes[PORT_MAX_CHANNELS / 4];
+
+  PitchQuantizer() {
+    reset();
+  }
+  void reset() {
+    // nothing near, so each channel's first sample rounds as usual
+    for (int g = 0; g < PORT_MAX_CHANNELS / 4; g++) {
+      notes[g] = -1000.f;
+    }
+  }
+  // c is the group's first channel; midi notes are whole-number floats
+  simd::float_4 process(const simd::float_4 voltage, int c, float hysteresis) {
+    simd::float_4 pitch = voltage * 12.f + 60.f;
+    simd::float_4 &note = notes[c / 4];
+    note = simd::ifelse(simd::abs(pitch - note) < 0.5f + hysteresis, note, simd::round(pitch));
+    return note;
+  }
 };
 
 
-// interface for the voicer strategy - module may switch between strategies
-struct Voicer {  // abstract
-  virtual void adjustOffsets(int* offsets) = 0;
-  virtual std::string displayName() = 0;
-};
-
-struct CloseVoicer : Voicer {
-  void adjustOffsets(int* offsets) override;
-  virtual std::string displayName() override;
-};
-
-struct DropTwoVoicer : Voicer {
-  void adjustOffsets(int* offsets) override;
-  virtual std::string displayName() override;
-};
-
-struct DropTwoFourVoicer : Voicer {
-  void adjustOffsets(int* offsets) override;
-  virtual std::string displayName() override;
-};
-
+struct NestlingAudio : Module, HarmonyCV {
 
-struct NestlingAudio : Module {
+  // the table the audio thread works from; when chords.json or chords.bin is saved, or "Reload chords" is picked
+  // in the context menu, the file is read again off the audio thread and updateChords() swaps the new table in
+  // at the start of the next process() call.  The UI thread must
+  // use chordsForUi() instead, since this pointer can change under it.
+  const ChordTable* chords = NULL;
+  uint32_t chordsGeneration = 0;
+  std::atomic<uint32_t> seenChordsGeneration {0};  // tells the library when the previous table is no longer in use
 
-  std::vector<std::string> chordNames;
-  std::vector<std::vector<int>> chordIntervals;
+  // MEL and ROOT go through these rather than cvToMidi; the hysteresis is set from the UI thread
+  PitchQuantizer melQuantizer;
+  PitchQuantizer rootQuantizer;
+  std::atomic<int> hysteresisCents {DEFAULT_HYSTERESIS_CENTS};
 
   // initialization
 	NestlingAudio();
+  ~NestlingAudio();
   void loadChords();
+  static std::shared_ptr<const ChordTable> readChordTable(const std::string &path);
+
+  // lock-free; true when a reloaded table was just picked up and anything derived from the old one is stale
+  bool updateChords();
+  std::shared_ptr<const ChordTable> chordsForUi() const;
+  // UI thread, for every module at once; false, with the old table kept, when the file doesn't load
+  static bool reloadChords();
+  static void appendReloadChordsMenu(Menu* menu);
+
+  // the quantizers' hysteresis in semitones, read once per process() call
+  float hysteresis() const {
+    return hysteresisCents.load(std::memory_order_relaxed) / 100.f;
+  }
+  void setHysteresisCents(int cents);
+  void hysteresisToJson(json_t* rootJ);
+  void hysteresisFromJson(json_t* rootJ);
+  void appendHysteresisMenu(Menu* menu);
 
   // processing
 	virtual void process(const ProcessArgs& args) override;
 
   // utility
-  int cvToMidi(const float voltage);
-  float midiToCV(const int midi);
-  std::string midiToString(const int midi);
-  size_t cvToIndex(const float voltage, const size_t length);
+  using HarmonyCV::cvToMidi;
+  using HarmonyCV::midiToCV;
+  using HarmonyCV::cvToIndex;
+
+  // polyphonic versions, four channels at a time; midi notes and indices are whole-number floats
+  simd::float_4 cvToMidi(const simd::float_4 voltage);
+  simd::float_4 midiToCV(const simd::float_4 midi);
+  simd::float_4 pitchClass(const simd::float_4 midi);
+  simd::float_4 cvToIndex(const simd::float_4 voltage, const size_t length);
 };
 
 
@@ -0,0 +1,40 @@
+#pragma once
+#include <atomic>
+
+// Hands a small copyable value from one writer thread to one reader thread with no locks and no waiting.
+// There are three slots: the writer fills its own and swaps it into the shared middle slot, and the reader
+// swaps the middle slot for its own only when something new is there.  Neither side ever sees a half-written
+// value, and the reader's check when nothing has changed is a single relaxed load.
+template <class T>
+struct SnapshotBuffer {
+  static const int INDEX_MASK = 3;
+  static const int FRESH = 4;  // set on the middle index when the writer has published since the reader last looked
+
+  T slots[3];
+  std::atomic<int> middle {1};
+  int writing = 0;  // only the writer touches this
+  int reading = 2;  // only the reader touches this
+
+  SnapshotBuffer(const T &initial = T()) {
+    slots[0] = slots[1] = slots[2] = initial;
+  }
+
+  // writer thread
+  void publish(const T &value) {
+    slots[writing] = value;
+    writing = middle.exchange(writing | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+  }
+
+  // reader thread: takes the latest published value, if there is one; true when read() changed
+  bool update() {
+    if (!(middle.load(std::memory_order_relaxed) & FRESH))
+      return false;
+    reading = middle.exchange(reading, std::memory_order_acq_rel) & INDEX_MASK;
+    return true;
+  }
+
+  // reader thread
+  const T &read() const {
+    return slots[reading];
+  }
+};
@@ -9,6 +9,8 @@ void init(Plugin* p) {
 	pluginInstance = p;
 	p->addModel(modelNestlingAudio_uJazz);
   p->addModel(modelNestlingAudio_Jazz);
+  p->addModel(modelNestlingAudio_ChordOut);
+  p->addModel(modelNestlingAudio_MidiOut);
 
 	// Add modules here
 	// p->addModel(modelMyModule);
@@ -11,3 +11,5 @@ extern Plugin* pluginInstance;
 // extern Model* modelMyModule;
 extern Model* modelNestlingAudio_uJazz;
 extern Model* modelNestlingAudio_Jazz;
+extern Model* modelNestlingAudio_ChordOut;
+extern Model* modelNestlingAudio_MidiOut;
@@ -6,14 +6,40 @@ endif
 TESTOBJECTS := $(patsubst %, testbuild/%.o, $(TESTS)) $(TESTOBJECTS)
 TESTOBJECTS += $(patsubst %, testbuild/%.bin.o, $(TESTBINARIES))
 TESTDEPENDENCIES := $(patsubst %, testbuild/%.d, $(TESTS))
+BENCHOBJECTS := $(patsubst %, testbuild/%.o, $(BENCHES))
+# the plugin's own objects, compiled by Rack's build/%.cpp.o rule
+HARMONYOBJECTS := $(patsubst %, build/%.o, $(HARMONY_SOURCES))
 
 # Final targets
 
+$(HARMONY_LIB): $(HARMONYOBJECTS)
+	@mkdir -p $(@D)
+	rm -f $@
+	$(AR) rcs $@ $^
+
+harmonylib: $(HARMONY_LIB)
+
+testexe: $(TESTOBJECTS) $(HARMONY_LIB)
+	$(CXX) -o $@ $^
+
+# fast enough to run after every change to the harmony code
+$(TESTTARGET): testexe
+	./testexe
 
-testexe: $(TESTOBJECTS)
-	$(CXX) -o $@ $^ 
+benchexe: $(BENCHOBJECTS) $(HARMONY_LIB)
+	$(CXX) -o $@ $^
+
+# each tool is its own program over the shared harmony code
+$(basename $(notdir $(TOOLS))): %: testbuild/tools/%.cpp.o $(HARMONY_LIB)
+	$(CXX) -o $@ $^
+
+# regenerates the committed res/chords.bin, which the plugin loads instead of chords.json unless the JSON is
+# newer; run it after editing chords.json.  Not part of `all`, so plugin builds never build or run chordc
+chordsbin: chordc
+	./chordc res/chords.json res/chords.bin
 
 -include $(TESTDEPENDENCIES)
+-include $(patsubst %, build/%.d, $(HARMONY_SOURCES))
 
 testbuild/%.c.o: %.c
 	@mkdir -p $(@D)
@@ -21,7 +47,7 @@ testbuild/%.c.o: %.c
 
 testbuild/%.cpp.o: %.cpp
 	@mkdir -p $(@D)
-	$(CXX) $(CXXFLAGS) -c -o $@ $<
+	$(CXX) $(CXXFLAGS) -Isrc -c -o $@ $<
 
 testbuild/%.cc.o: %.cc
 	@mkdir -p $(@D)
@@ -1,6 +1,285 @@
-#include <iostream>
+#include "Harmony.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
 
+// Correctness tests for the harmonizers and voicers, run against the shipped res/chords.json.  Sweeps every
+// chord type, root, MIDI melody note, voice count and harmonizer x voicer pair checking the rules the README
+// promises, then checks the README's worked examples note for note.  Meant to run on every change to the
+// lookup tables or the processing paths, so it has to stay fast.
+//
+// usage: testexe [chords.json]
 
-int main() {
-  std::cout << "foo\n";
+
+static int failures = 0;
+
+// keeps going after a failure so one run shows the whole picture, but only prints the first few
+#define CHECK(condition, ...) do { \
+    if (!(condition)) { \
+      if (failures < 20) { \
+        std::fprintf(stderr, "%s:%d: CHECK(%s) failed: ", __FILE__, __LINE__, #condition); \
+        std::fprintf(stderr, __VA_ARGS__); \
+        std::fprintf(stderr, "\n"); \
+      } \
+      failures++; \
+    } \
+  } while (0)
+
+
+static bool inChord(const ChordTable &chords, size_t chordTypeIndex, int relativePitchClass) {
+  if (relativePitchClass == 0) return true;
+  for (size_t i = 0; i < chords.numIntervals(chordTypeIndex); i++) {
+    if (chords.chordIntervals(chordTypeIndex)[i] % 12 == relativePitchClass) return true;
+  }
+  return false;
+}
+
+static int pitchClass(int note) {
+  return (note % 12 + 12) % 12;
+}
+
+
+// what the README says of every harmony: voices below the melody, highest first, no two alike and no MIDI
+// note below 0; chord tone melodies get chord tones, and Diminished Passing puts a diminished seventh chord
+// under any other melody note whatever the voicing
+static void checkHarmony(const ChordTable &chords, size_t h, size_t v, size_t chordTypeIndex, int root, int melody,
+    int numVoices, const int* offsets) {
+  int relativeMelNote = pitchClass(melody - root);
+  bool chordTone = inChord(chords, chordTypeIndex, relativeMelNote);
+  for (int i = 0; i < numVoices; i++) {
+    CHECK(offsets[i] < 0, "h%zu v%zu chord %zu root %d melody %d voice %d offset %d", h, v, chordTypeIndex, root, melody, i, offsets[i]);
+    CHECK(offsets[i] >= -48, "h%zu v%zu chord %zu melody %d voice %d offset %d", h, v, chordTypeIndex, melody, i, offsets[i]);
+    if (i > 0) {
+      CHECK(offsets[i] < offsets[i - 1], "h%zu v%zu chord %zu melody %d voices %d and %d out of order", h, v, chordTypeIndex, melody, i - 1, i);
+    }
+    int note = HarmonyCV::voiceNote(melody, offsets[i]);
+    CHECK(note >= 0 && note <= melody, "h%zu v%zu melody %d voice %d note %d", h, v, melody, i, note);
+    if (chordTone) {
+      CHECK(inChord(chords, chordTypeIndex, pitchClass(melody + offsets[i] - root)),
+          "h%zu v%zu chord %zu root %d melody %d voice %d is not a chord tone", h, v, chordTypeIndex, root, melody, i);
+    } else if (h == 0) {
+      CHECK(offsets[i] % 3 == 0, "h%zu v%zu chord %zu root %d melody %d voice %d is not diminished", h, v, chordTypeIndex, root, melody, i);
+    }
+  }
+}
+
+static void testSweep(const ChordTable &chords) {
+  HarmonyStrategies strategies;
+  strategies.init(&chords);
+
+  for (size_t h = 0; h < HarmonyStrategies::NUM_HARMONIZERS; h++) {
+    for (size_t v = 0; v < HarmonyStrategies::NUM_VOICERS; v++) {
+      for (int numVoices = MIN_VOICES; numVoices <= MAX_VOICES; numVoices++) {
+        for (size_t chordTypeIndex = 0; chordTypeIndex < chords.size(); chordTypeIndex++) {
+          for (int root = 0; root < 12; root++) {
+            // one state per pass, so the stateful harmonizers see a long run of notes
+            strategies.randomPassing.random.seed(1);
+            HarmonyState state;
+            for (int melody = 0; melody < 128; melody++) {
+              int offsets[MAX_VOICES];
+              strategies.harmonizers[h]->computeOffsets(chordTypeIndex, melody, root, numVoices, state, offsets);
+              strategies.voicers[v]->adjustOffsets(offsets, numVoices);
+              checkHarmony(chords, h, v, chordTypeIndex, root, melody, numVoices, offsets);
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+// the module's default: with close voicing a chord tone melody sits on top of the chord's other tones, each
+// voice the next one down, all within the octave below.  Only four-note chords fill the three voices that way;
+// others double or leave out tones, and the sweep covers them
+static void testInversions(const ChordTable &chords) {
+  BasicHarmonizer harmonizer;
+  harmonizer.init(&chords);
+  for (size_t chordTypeIndex = 0; chordTypeIndex < chords.size(); chordTypeIndex++) {
+    if (chords.numIntervals(chordTypeIndex) != 3) continue;
+    for (int root = 0; root < 12; root++) {
+      for (int melody = 36; melody < 96; melody++) {
+        if (!inChord(chords, chordTypeIndex, pitchClass(melody - root))) continue;
+        HarmonyState state;
+        int offsets[MAX_VOICES];
+        harmonizer.computeOffsets(chordTypeIndex, melody, root, DEFAULT_VOICES, state, offsets);
+        int expected = 0;
+        for (int i = 0; i < DEFAULT_VOICES; i++) {
+          // walk down to the next chord tone below the last voice
+          do {
+            expected--;
+          } while (!inChord(chords, chordTypeIndex, pitchClass(melody + expected - root)));
+          CHECK(offsets[i] == expected, "chord %zu root %d melody %d voice %d offset %d, expected %d", chordTypeIndex, root, melody, i, offsets[i], expected);
+        }
+        CHECK(offsets[DEFAULT_VOICES - 1] > -12, "chord %zu root %d melody %d spans more than an octave", chordTypeIndex, root, melody);
+      }
+    }
+  }
+}
+
+// passing tones under the other harmonizers: Parallel repeats the last harmony's shape, Scale stays in the
+// chord's scale when the melody is in it
+static void testPassingTones(const ChordTable &chords) {
+  ParallelHarmonizer parallel;
+  parallel.init(&chords);
+  ScaleHarmonizer scale;
+  scale.init(&chords);
+  for (size_t chordTypeIndex = 0; chordTypeIndex < chords.size(); chordTypeIndex++) {
+    for (int melody = 48; melody < 84; melody++) {
+      int relativeMelNote = pitchClass(melody);
+      if (inChord(chords, chordTypeIndex, relativeMelNote)) continue;
+
+      HarmonyState state;
+      int before[MAX_VOICES], offsets[MAX_VOICES];
+      parallel.computeOffsets(chordTypeIndex, 60, 0, DEFAULT_VOICES, state, before);
+      parallel.computeOffsets(chordTypeIndex, melody, 0, DEFAULT_VOICES, state, offsets);
+      for (int i = 0; i < DEFAULT_VOICES; i++) {
+        CHECK(offsets[i] == before[i], "parallel chord %zu melody %d voice %d moved", chordTypeIndex, melody, i);
+      }
+
+      scale.computeOffsets(chordTypeIndex, melody, 0, DEFAULT_VOICES, state, offsets);
+      bool inScale = chords.scaleMasks[chordTypeIndex] & (1 << relativeMelNote);
+      for (int i = 0; i < DEFAULT_VOICES; i++) {
+        int voice = pitchClass(melody + offsets[i]);
+        if (inScale) {
+          CHECK(chords.scaleMasks[chordTypeIndex] & (1 << voice), "scale chord %zu melody %d voice %d is outside the scale", chordTypeIndex, melody, i);
+        } else {
+          CHECK(offsets[i] == -3 * (i + 1), "scale chord %zu melody %d voice %d should fall back to diminished", chordTypeIndex, melody, i);
+        }
+      }
+    }
+  }
+}
+
+// switching harmonizer on every note with one state per channel, as the Jazz module does when its knob
+// moves: the rules still hold, and Parallel's passing tones keep whatever harmony was last played
+static void testSwitching(const ChordTable &chords) {
+  HarmonyStrategies strategies;
+  strategies.init(&chords);
+  HarmonyRandom random;
+  random.seed(1);
+  for (size_t chordTypeIndex = 0; chordTypeIndex < chords.size(); chordTypeIndex++) {
+    for (int root = 0; root < 12; root++) {
+      HarmonyState state;
+      int last[MAX_VOICES] = {};
+      for (int step = 0; step < 200; step++) {
+        size_t h = random.uniformInt(0, HarmonyStrategies::NUM_HARMONIZERS - 1);
+        int melody = random.uniformInt(40, 90);
+        int offsets[MAX_VOICES];
+        strategies.harmonizers[h]->computeOffsets(chordTypeIndex, melody, root, DEFAULT_VOICES, state, offsets);
+        strategies.voicers[0]->adjustOffsets(offsets, DEFAULT_VOICES);
+        checkHarmony(chords, h, 0, chordTypeIndex, root, melody, DEFAULT_VOICES, offsets);
+        if (h == 1 && step > 0 && !inChord(chords, chordTypeIndex, pitchClass(melody - root))) {
+          for (int i = 0; i < DEFAULT_VOICES; i++) {
+            CHECK(offsets[i] == last[i], "chord %zu root %d step %d: parallel passing tone did not follow the last harmony", chordTypeIndex, root, step);
+          }
+        }
+        std::copy(offsets, offsets + DEFAULT_VOICES, last);
+      }
+    }
+  }
+}
+
+
+// the README's examples, as MIDI notes with C5 = 72
+struct Example {
+  const char* chord;
+  int root;
+  int melody;
+  int expected[3];
+};
+
+static const Example README_EXAMPLES[] = {
+  {"maj7", 0, 72, {71, 67, 64}},  // C5: B4 G4 E4
+  {"maj7", 0, 74, {71, 68, 65}},  // D5: B4 G#4 F4
+  {"maj7", 0, 76, {72, 71, 67}},  // E5: C5 B4 G4
+  {"-7", 2, 73, {70, 67, 64}},  // C#5: A#4 G4 E4
+  {"-7", 2, 74, {72, 69, 65}},  // D5: C5 A4 F4
+  {"-7", 2, 76, {73, 70, 67}},  // E5: C#5 A#4 G4
+  {"-7", 2, 77, {74, 72, 69}},  // F5: D5 C5 A4
+};
+
+static void testReadmeExamples(const ChordTable &chords) {
+  HarmonyStrategies strategies;
+  strategies.init(&chords);
+  for (const Example &example : README_EXAMPLES) {
+    size_t chordTypeIndex = chords.size();
+    for (size_t c = 0; c < chords.size(); c++) {
+      if (chords.names[c] == example.chord) chordTypeIndex = c;
+    }
+    CHECK(chordTypeIndex < chords.size(), "no chord named %s", example.chord);
+    if (chordTypeIndex == chords.size()) continue;
+
+    // µJazz's path, and Jazz's with its knobs at their defaults
+    BasicHarmonizer harmonizer;
+    harmonizer.init(&chords);
+    HarmonyState state, jazzState;
+    int offsets[MAX_VOICES], jazzOffsets[MAX_VOICES];
+    harmonizer.computeOffsets(chordTypeIndex, example.melody, example.root, DEFAULT_VOICES, state, offsets);
+    strategies.harmonizers[0]->computeOffsets(chordTypeIndex, example.melody, example.root, DEFAULT_VOICES, jazzState, jazzOffsets);
+    strategies.voicers[0]->adjustOffsets(jazzOffsets, DEFAULT_VOICES);
+    for (int i = 0; i < DEFAULT_VOICES; i++) {
+      int note = HarmonyCV::voiceNote(example.melody, offsets[i]);
+      CHECK(note == example.expected[i], "%s%s melody %s: output %d is %d, README says %d", HarmonyCV::midiToString(example.root).c_str(),
+          example.chord, HarmonyCV::midiToString(example.melody).c_str(), i + 1, note, example.expected[i]);
+      CHECK(jazzOffsets[i] == offsets[i], "%s melody %d: Jazz and µJazz disagree on output %d", example.chord, example.melody, i + 1);
+    }
+  }
+}
+
+// every chord type the README lists is there, in the README's order, and the chord type knob and CV split
+// 0-10v evenly over however many types the table has
+static void testChordOrder(const ChordTable &chords) {
+  const char* names[] = {"dim7", "-7b5", "-7", "-(maj7)", "7", "maj7", "7#5", "maj7#5", "sus7", "sus(maj7)"};
+  size_t next = 0;
+  for (const char* name : names) {
+    size_t c = std::find(chords.names.begin(), chords.names.end(), name) - chords.names.begin();
+    CHECK(c < chords.size(), "no chord named %s", name);
+    if (c == chords.size()) continue;
+    CHECK(c >= next, "%s comes before the chord the README lists ahead of it", name);
+    next = c + 1;
+  }
+  for (size_t c = 0; c < chords.size(); c++) {
+    float voltage = (c + 0.5f) * 10.f / chords.size();
+    CHECK(HarmonyCV::cvToIndex(voltage, chords.size()) == c, "%gv does not select chord %zu", voltage, c);
+  }
+  CHECK(HarmonyCV::cvToIndex(10.f, chords.size()) == chords.size() - 1, "10v is past the last chord");
+}
+
+
+int main(int argc, char** argv) {
+  std::string chordsPath = argc > 1 ? argv[1] : "res/chords.json";
+  std::ifstream file(chordsPath.c_str());
+  if (!file) {
+    std::fprintf(stderr, "can't open %s\n", chordsPath.c_str());
+    return 1;
+  }
+  std::stringstream text;
+  text << file.rdbuf();
+  ChordTable chords;
+  int line, column;
+  std::string error;
+  if (!chords.parseJson(text.str(), &line, &column, &error)) {
+    std::fprintf(stderr, "%s:%d:%d: %s\n", chordsPath.c_str(), line, column, error.c_str());
+    return 1;
+  }
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  testChordOrder(chords);
+  testReadmeExamples(chords);
+  testInversions(chords);
+  testPassingTones(chords);
+  testSwitching(chords);
+  testSweep(chords);
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  if (failures) {
+    std::printf("%d checks failed\n", failures);
+    return 1;
+  }
+  std::printf("all passed in %.3f s\n", seconds);
+  return 0;
 }
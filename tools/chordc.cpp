@@ -0,0 +1,55 @@
+#include "Harmony.hpp"
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+// Chord table compiler: checks a chords.json file and writes the precompiled chords.bin the plugin loads in
+// preference to it.  Reading the binary skips the JSON parse, which matters for dictionaries of hundreds of chords.
+//
+// usage: chordc [chords.json] [chords.bin]    (defaults res/chords.json res/chords.bin)
+
+
+int main(int argc, char** argv) {
+  std::string inPath = argc > 1 ? argv[1] : "res/chords.json";
+  std::string outPath = argc > 2 ? argv[2] : "res/chords.bin";
+
+  std::ifstream in(inPath.c_str(), std::ios::binary);
+  if (!in) {
+    std::fprintf(stderr, "chordc: can't open %s\n", inPath.c_str());
+    return 1;
+  }
+  std::stringstream text;
+  text << in.rdbuf();
+
+  ChordTable chords;
+  int line, column;
+  std::string error;
+  if (!chords.parseJson(text.str(), &line, &column, &error)) {
+    std::fprintf(stderr, "%s:%d:%d: %s\n", inPath.c_str(), line, column, error.c_str());
+    return 1;
+  }
+  if (chords.size() == 0) {
+    std::fprintf(stderr, "chordc: %s has no chords\n", inPath.c_str());
+    return 1;
+  }
+
+  std::string binary = chords.toBinary();
+  // read it back so a bad file never gets as far as the plugin
+  ChordTable check;
+  if (!check.parseBinary(binary.data(), binary.size(), &error) || check.names != chords.names
+      || check.intervals != chords.intervals || check.scaleMasks != chords.scaleMasks) {
+    std::fprintf(stderr, "chordc: round trip failed %s\n", error.c_str());
+    return 1;
+  }
+
+  std::ofstream out(outPath.c_str(), std::ios::binary);
+  out.write(binary.data(), binary.size());
+  out.close();
+  if (!out) {
+    std::fprintf(stderr, "chordc: can't write %s\n", outPath.c_str());
+    return 1;
+  }
+  std::printf("%s: %zu chords, %zu bytes\n", outPath.c_str(), chords.size(), binary.size());
+  return 0;
+}
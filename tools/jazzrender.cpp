@@ -0,0 +1,442 @@
+#include "Harmony.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Offline harmonizer: reads a melody from a Standard MIDI File and a chord chart, harmonizes every melody
+// note with the same Harmonizer/Voicer code the Jazz module uses, and writes the melody plus one track per
+// harmony voice to a new MIDI file.  Works event by event, so a song takes microseconds, not its running time.
+//
+// usage: jazzrender [options] melody.mid chart.txt out.mid [melody2.mid chart2.txt out2.mid ...]
+//
+// options:
+//   --chords FILE        chord definitions, chords.json or a chords.bin from chordc (default res/chords.json)
+//   --harmonizer NAME    basic, parallel, random, scale or voiceleading (default basic)
+//   --voicing NAME       close, drop2 or drop24 (default close)
+//   --seed N             seed for the random harmonizer, reset for each file (default 1)
+//   --voices N           harmony voices, 2 to 7 (default 3)
+//   --track N            MIDI track holding the melody (default: first track with notes)
+//   --channel N          MIDI channel of the melody, 1 to 16; events on other channels are left out (default:
+//                        the only channel the melody track plays notes on, an error if there are several)
+//
+// The chart has one chord change per line: the time in beats (quarter notes) from the start, the root and
+// the chord type name from chords.json, separated by spaces or commas.  A word starting with '#' begins a
+// comment that runs to the end of the line.
+//
+//   # ii-V-I in C
+//   0   D  -7
+//   4   G  7
+//   8   C  maj7
+
+
+struct MidiEvent {
+  uint32_t tick;
+  std::vector<uint8_t> data;  // status byte first; meta events keep the 0xFF, type and length
+};
+
+struct MidiFile {
+  uint16_t division = 480;
+  std::vector<std::vector<MidiEvent>> tracks;
+};
+
+struct ChordChange {
+  uint32_t tick;
+  int root;
+  size_t chordTypeIndex;
+};
+
+
+static bool fail(const std::string &message) {
+  std::fprintf(stderr, "jazzrender: %s\n", message.c_str());
+  return false;
+}
+
+static bool readFile(const std::string &path, std::string* out) {
+  std::ifstream file(path.c_str(), std::ios::binary);
+  if (!file) return fail("can't open " + path);
+  std::stringstream buffer;
+  buffer << file.rdbuf();
+  *out = buffer.str();
+  return true;
+}
+
+
+// MIDI FILE IO
+
+static uint32_t readBigEndian(const uint8_t* p, int bytes) {
+  uint32_t value = 0;
+  for (int i = 0; i < bytes; i++) value = (value << 8) | p[i];
+  return value;
+}
+
+static bool readVarLen(const uint8_t* &p, const uint8_t* end, uint32_t* value) {
+  *value = 0;
+  for (int i = 0; i < 4; i++) {
+    if (p >= end) return false;
+    uint8_t byte = *p++;
+    *value = (*value << 7) | (byte & 0x7f);
+    if (!(byte & 0x80)) return true;
+  }
+  return false;
+}
+
+static bool readMidi(const std::string &path, MidiFile* midi) {
+  std::string bytes;
+  if (!readFile(path, &bytes)) return false;
+  const uint8_t* p = (const uint8_t*) bytes.data();
+  const uint8_t* end = p + bytes.size();
+
+  if (bytes.size() < 14 || std::memcmp(p, "MThd", 4) != 0) return fail(path + ": not a MIDI file");
+  uint32_t headerLength = readBigEndian(p + 4, 4);
+  uint16_t numTracks = readBigEndian(p + 10, 2);
+  midi->division = readBigEndian(p + 12, 2);
+  if (midi->division & 0x8000) return fail(path + ": SMPTE time division is not supported");
+  p += 8 + headerLength;
+
+  for (int t = 0; t < numTracks; t++) {
+    if (end - p < 8 || std::memcmp(p, "MTrk", 4) != 0) return fail(path + ": bad track header");
+    uint32_t trackLength = readBigEndian(p + 4, 4);
+    p += 8;
+    const uint8_t* trackEnd = p + trackLength;
+    if (trackEnd > end) return fail(path + ": truncated track");
+
+    midi->tracks.push_back(std::vector<MidiEvent>());
+    std::vector<MidiEvent> &track = midi->tracks.back();
+    uint32_t tick = 0;
+    uint8_t runningStatus = 0;
+    while (p < trackEnd) {
+      uint32_t delta;
+      if (!readVarLen(p, trackEnd, &delta)) return fail(path + ": bad delta time");
+      tick += delta;
+      if (p >= trackEnd) return fail(path + ": truncated event");
+
+      MidiEvent event;
+      event.tick = tick;
+      uint8_t status = *p;
+      if (status == 0xff || status == 0xf0 || status == 0xf7) {
+        const uint8_t* start = p;
+        p += (status == 0xff) ? 2 : 1;
+        uint32_t length;
+        if (p > trackEnd || !readVarLen(p, trackEnd, &length) || p + length > trackEnd)
+          return fail(path + ": bad meta or sysex event");
+        p += length;
+        event.data.assign(start, p);
+        // meta and sysex events cancel running status
+        runningStatus = 0;
+      } else {
+        if (status & 0x80) {
+          runningStatus = status;
+          p++;
+        } else if (!runningStatus) {
+          return fail(path + ": data byte without a status");
+        }
+        int dataBytes = ((runningStatus & 0xf0) == 0xc0 || (runningStatus & 0xf0) == 0xd0) ? 1 : 2;
+        if (p + dataBytes > trackEnd) return fail(path + ": truncated event");
+        event.data.push_back(runningStatus);
+        event.data.insert(event.data.end(), p, p + dataBytes);
+        p += dataBytes;
+      }
+      track.push_back(event);
+    }
+    p = trackEnd;
+  }
+  return true;
+}
+
+static void writeVarLen(std::string* out, uint32_t value) {
+  uint8_t buffer[4];
+  int n = 0;
+  do {
+    buffer[n++] = value & 0x7f;
+    value >>= 7;
+  } while (value);
+  while (n > 1) out->push_back(buffer[--n] | 0x80);
+  out->push_back(buffer[0]);
+}
+
+static void writeBigEndian(std::string* out, uint32_t value, int bytes) {
+  for (int i = bytes - 1; i >= 0; i--) out->push_back((value >> (8 * i)) & 0xff);
+}
+
+static bool writeMidi(const std::string &path, const MidiFile &midi) {
+  std::string bytes = "MThd";
+  writeBigEndian(&bytes, 6, 4);
+  writeBigEndian(&bytes, 1, 2);
+  writeBigEndian(&bytes, midi.tracks.size(), 2);
+  writeBigEndian(&bytes, midi.division, 2);
+
+  for (const std::vector<MidiEvent> &track : midi.tracks) {
+    std::string body;
+    uint32_t tick = 0;
+    for (const MidiEvent &event : track) {
+      writeVarLen(&body, event.tick - tick);
+      tick = event.tick;
+      body.append(event.data.begin(), event.data.end());
+    }
+    const uint8_t endOfTrack[] = {0x00, 0xff, 0x2f, 0x00};
+    body.append(endOfTrack, endOfTrack + 4);
+    bytes += "MTrk";
+    writeBigEndian(&bytes, body.size(), 4);
+    bytes += body;
+  }
+
+  std::ofstream file(path.c_str(), std::ios::binary);
+  if (!file) return fail("can't write " + path);
+  file.write(bytes.data(), bytes.size());
+  return true;
+}
+
+static bool isNoteOn(const MidiEvent &event) {
+  return (event.data[0] & 0xf0) == 0x90 && event.data[2] > 0;
+}
+
+static bool isNoteOff(const MidiEvent &event) {
+  return (event.data[0] & 0xf0) == 0x80 || ((event.data[0] & 0xf0) == 0x90 && event.data[2] == 0);
+}
+
+static int channelOf(const MidiEvent &event) {
+  return event.data[0] & 0x0f;
+}
+
+
+// CHORD CHART
+
+static int parseRoot(const std::string &name) {
+  const char* letters = "C D EF G A B";
+  if (name.empty()) return -1;
+  const char* letter = std::strchr(letters, std::toupper((unsigned char) name[0]));
+  if (!letter || *letter == ' ') return -1;
+  int root = letter - letters;
+  for (size_t i = 1; i < name.size(); i++) {
+    if (name[i] == '#') root++;
+    else if (name[i] == 'b') root--;
+    else return -1;
+  }
+  return (root + 12) % 12;
+}
+
+static bool readChart(const std::string &path, const ChordTable &chords, uint16_t division, std::vector<ChordChange>* chart) {
+  std::string text;
+  if (!readFile(path, &text)) return false;
+  std::istringstream lines(text);
+  std::string line;
+  int lineNumber = 0;
+  while (std::getline(lines, line)) {
+    lineNumber++;
+    // '#' starts a comment only at the start of a word, so sharps like C# still parse
+    for (size_t i = 0; i < line.size(); i++) {
+      if (line[i] == '#' && (i == 0 || std::isspace((unsigned char) line[i - 1]))) {
+        line.resize(i);
+        break;
+      }
+    }
+    std::replace(line.begin(), line.end(), ',', ' ');
+    std::istringstream fields(line);
+    double beat;
+    std::string rootName, chordName;
+    if (!(fields >> beat)) continue;  // blank or comment
+    if (!(fields >> rootName >> chordName) || beat < 0)
+      return fail(path + ":" + std::to_string(lineNumber) + ": expected <beat> <root> <chord type>");
+
+    ChordChange change;
+    change.tick = (uint32_t) (beat * division + 0.5);
+    change.root = parseRoot(rootName);
+    if (change.root < 0) return fail(path + ":" + std::to_string(lineNumber) + ": unknown root " + rootName);
+    change.chordTypeIndex = std::find(chords.names.begin(), chords.names.end(), chordName) - chords.names.begin();
+    if (change.chordTypeIndex >= chords.size())
+      return fail(path + ":" + std::to_string(lineNumber) + ": unknown chord type " + chordName);
+    chart->push_back(change);
+  }
+  if (chart->empty()) return fail(path + ": no chords");
+  std::stable_sort(chart->begin(), chart->end(), [](const ChordChange &a, const ChordChange &b) {
+    return a.tick < b.tick;
+  });
+  return true;
+}
+
+
+// RENDERING
+
+static bool render(const std::string &melodyPath, const std::string &chartPath, const std::string &outPath,
+    const ChordTable &chords, Harmonizer* harmonizer, Voicer* voicer, int numVoices, int melodyTrack, int melodyChannel) {
+  MidiFile in;
+  if (!readMidi(melodyPath, &in)) return false;
+  std::vector<ChordChange> chart;
+  if (!readChart(chartPath, chords, in.division, &chart)) return false;
+
+  if (melodyTrack < 0) {
+    for (size_t t = 0; t < in.tracks.size() && melodyTrack < 0; t++) {
+      for (const MidiEvent &event : in.tracks[t]) {
+        if (isNoteOn(event) && (melodyChannel < 0 || channelOf(event) == melodyChannel)) {
+          melodyTrack = t;
+          break;
+        }
+      }
+    }
+  }
+  if (melodyTrack < 0 || melodyTrack >= (int) in.tracks.size()) return fail(melodyPath + ": no melody track");
+  // one channel is one melody; folding several into it would harmonize chords and counterlines as a tune
+  if (melodyChannel < 0) {
+    for (const MidiEvent &event : in.tracks[melodyTrack]) {
+      if (!isNoteOn(event)) continue;
+      if (melodyChannel < 0) melodyChannel = channelOf(event);
+      else if (channelOf(event) != melodyChannel)
+        return fail(melodyPath + ": melody track plays channels " + std::to_string(melodyChannel + 1) + " and " +
+            std::to_string(channelOf(event) + 1) + "; choose one with --channel");
+    }
+  }
+
+  // track 0 keeps the tempo and time signature, track 1 the melody, then one track per harmony voice
+  MidiFile out;
+  out.division = in.division;
+  out.tracks.resize(2 + numVoices);
+  for (const std::vector<MidiEvent> &track : in.tracks) {
+    for (const MidiEvent &event : track) {
+      if (event.data[0] == 0xff && event.data[1] != 0x2f && event.data[1] != 0x03) out.tracks[0].push_back(event);
+    }
+  }
+  std::stable_sort(out.tracks[0].begin(), out.tracks[0].end(), [](const MidiEvent &a, const MidiEvent &b) {
+    return a.tick < b.tick;
+  });
+
+  HarmonyState state;
+  int sounding[128][MAX_VOICES];  // harmony notes started by each melody note, so its note off can end them
+  bool isSounding[128] = {};
+  size_t chordIndex = 0;
+  for (const MidiEvent &event : in.tracks[melodyTrack]) {
+    if (event.data[0] >= 0xf0 || channelOf(event) != melodyChannel) continue;
+    out.tracks[1].push_back(event);
+    uint8_t channel = melodyChannel;
+
+    // a note off, or a retrigger of a note that is still held, ends the harmony that note started
+    if ((isNoteOn(event) || isNoteOff(event)) && isSounding[event.data[1]]) {
+      int melNote = event.data[1];
+      for (int v = 0; v < numVoices; v++) {
+        MidiEvent noteOff;
+        noteOff.tick = event.tick;
+        noteOff.data.push_back(0x80 | ((channel + 1 + v) & 0x0f));
+        noteOff.data.push_back(sounding[melNote][v]);
+        noteOff.data.push_back(0);
+        out.tracks[2 + v].push_back(noteOff);
+      }
+      isSounding[melNote] = false;
+    }
+    if (isNoteOn(event)) {
+      while (chordIndex + 1 < chart.size() && chart[chordIndex + 1].tick <= event.tick) chordIndex++;
+      const ChordChange &chord = chart[chordIndex];
+      int melNote = event.data[1];
+
+      int offsets[MAX_VOICES];
+      harmonizer->computeOffsets(chord.chordTypeIndex, melNote, chord.root, numVoices, state, offsets);
+      voicer->adjustOffsets(offsets, numVoices);
+
+      for (int v = 0; v < numVoices; v++) {
+        int note = HarmonyCV::voiceNote(melNote, offsets[v]);
+        sounding[melNote][v] = note;
+        MidiEvent noteOn;
+        noteOn.tick = event.tick;
+        noteOn.data.push_back(0x90 | ((channel + 1 + v) & 0x0f));
+        noteOn.data.push_back(note);
+        noteOn.data.push_back(event.data[2]);
+        out.tracks[2 + v].push_back(noteOn);
+      }
+      isSounding[melNote] = true;
+    }
+  }
+
+  return writeMidi(outPath, out);
+}
+
+
+int main(int argc, char** argv) {
+  std::string chordsPath = "res/chords.json";
+  std::string harmonizerName = "basic";
+  std::string voicingName = "close";
+  uint64_t seed = 1;
+  int numVoices = DEFAULT_VOICES;
+  int melodyTrack = -1;
+  int melodyChannel = -1;
+  std::vector<std::string> files;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "--chords" && hasValue) chordsPath = argv[++i];
+    else if (arg == "--harmonizer" && hasValue) harmonizerName = argv[++i];
+    else if (arg == "--voicing" && hasValue) voicingName = argv[++i];
+    else if (arg == "--seed" && hasValue) seed = std::strtoull(argv[++i], NULL, 10);
+    else if (arg == "--voices" && hasValue) numVoices = std::atoi(argv[++i]);
+    else if (arg == "--track" && hasValue) melodyTrack = std::atoi(argv[++i]);
+    else if (arg == "--channel" && hasValue) {
+      melodyChannel = std::atoi(argv[++i]) - 1;
+      if (melodyChannel < 0 || melodyChannel > 15) {
+        fail("--channel must be from 1 to 16");
+        return 2;
+      }
+    }
+    else if (arg.compare(0, 2, "--") == 0) {
+      fail("unknown option " + arg);
+      return 2;
+    }
+    else files.push_back(arg);
+  }
+  if (files.empty() || files.size() % 3 != 0) {
+    std::fprintf(stderr, "usage: jazzrender [options] melody.mid chart.txt out.mid [...]\n");
+    return 2;
+  }
+  if (numVoices < MIN_VOICES || numVoices > MAX_VOICES) {
+    fail("--voices must be from " + std::to_string(MIN_VOICES) + " to " + std::to_string(MAX_VOICES));
+    return 2;
+  }
+
+  std::string text;
+  if (!readFile(chordsPath, &text)) return 1;
+  ChordTable chords;
+  int line, column;
+  std::string error;
+  if (ChordTable::isBinary(text.data(), text.size())) {
+    if (!chords.parseBinary(text.data(), text.size(), &error)) {
+      fail(chordsPath + ": " + error);
+      return 1;
+    }
+  } else if (!chords.parseJson(text, &line, &column, &error)) {
+    fail(chordsPath + ":" + std::to_string(line) + ":" + std::to_string(column) + ": " + error);
+    return 1;
+  }
+
+  HarmonyStrategies strategies;
+  strategies.init(&chords);
+  Harmonizer* harmonizer;
+  if (harmonizerName == "basic") harmonizer = &strategies.basic;
+  else if (harmonizerName == "parallel") harmonizer = &strategies.parallel;
+  else if (harmonizerName == "random") harmonizer = &strategies.randomPassing;
+  else if (harmonizerName == "scale") harmonizer = &strategies.scale;
+  else if (harmonizerName == "voiceleading") harmonizer = &strategies.voiceLeading;
+  else {
+    fail("unknown harmonizer " + harmonizerName);
+    return 2;
+  }
+
+  Voicer* voicer;
+  if (voicingName == "close") voicer = &strategies.close;
+  else if (voicingName == "drop2") voicer = &strategies.dropTwo;
+  else if (voicingName == "drop24") voicer = &strategies.dropTwoFour;
+  else {
+    fail("unknown voicing " + voicingName);
+    return 2;
+  }
+
+  int failures = 0;
+  for (size_t i = 0; i < files.size(); i += 3) {
+    // reseeded per file, so each render comes out the same whether it's rendered alone or after others
+    strategies.randomPassing.random.seed(seed);
+    if (!render(files[i], files[i + 1], files[i + 2], chords, harmonizer, voicer, numVoices, melodyTrack, melodyChannel)) failures++;
+  }
+  return failures ? 1 : 0;
+}